@@ -0,0 +1,123 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Runs pipewire-audio-e2e against a private PipeWire and WirePlumber instance.
+# Everything lives in a temporary XDG_RUNTIME_DIR, config and state directory that is removed on exit,
+# the session's own daemon, devices and saved state are left alone.
+#
+# Usage: pipewire-audio-e2e.sh <pipewire-audio-e2e> <linux-pipewire-audio.so> [data_path] [-- driver options]
+
+set -eu
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 <pipewire-audio-e2e> <linux-pipewire-audio.so> [data_path] [-- driver options]" >&2
+	exit 2
+fi
+
+driver=$1
+module=$2
+shift 2
+
+data_path=
+if [ $# -gt 0 ] && [ "$1" != "--" ]; then
+	data_path=$1
+	shift
+fi
+if [ $# -gt 0 ] && [ "$1" = "--" ]; then
+	shift
+fi
+
+for tool in pipewire wireplumber pw-cli; do
+	if ! command -v "$tool" >/dev/null 2>&1; then
+		echo "$tool is needed to run the end-to-end check" >&2
+		exit 2
+	fi
+done
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/obs-pipewire-e2e.XXXXXX")
+pipewire_pid=
+wireplumber_pid=
+
+cleanup() {
+	for pid in $wireplumber_pid $pipewire_pid; do
+		kill "$pid" 2>/dev/null || true
+		wait "$pid" 2>/dev/null || true
+	done
+	rm -rf "$dir"
+}
+trap cleanup EXIT
+trap 'exit 130' INT TERM
+
+export XDG_RUNTIME_DIR="$dir/runtime"
+export XDG_CONFIG_HOME="$dir/config"
+export XDG_STATE_HOME="$dir/state"
+unset PIPEWIRE_REMOTE PIPEWIRE_RUNTIME_DIR DBUS_SESSION_BUS_ADDRESS
+mkdir -p -m 700 "$XDG_RUNTIME_DIR"
+
+# No device monitors, the null sink the driver creates is the only sink.
+# WirePlumber 0.5 reads the drop-in, 0.4 the Lua fragments
+mkdir -p "$XDG_CONFIG_HOME/wireplumber/wireplumber.conf.d" "$XDG_CONFIG_HOME/wireplumber/main.lua.d" \
+	"$XDG_CONFIG_HOME/wireplumber/bluetooth.lua.d"
+cat >"$XDG_CONFIG_HOME/wireplumber/wireplumber.conf.d/90-obs-e2e.conf" <<EOF
+wireplumber.profiles = {
+  main = {
+    monitor.alsa = disabled
+    monitor.alsa-midi = disabled
+    monitor.bluez = disabled
+    monitor.bluez-midi = disabled
+    monitor.v4l2 = disabled
+    monitor.libcamera = disabled
+  }
+}
+EOF
+cat >"$XDG_CONFIG_HOME/wireplumber/main.lua.d/51-obs-e2e.lua" <<EOF
+alsa_monitor.enabled = false
+v4l2_monitor.enabled = false
+libcamera_monitor.enabled = false
+EOF
+cat >"$XDG_CONFIG_HOME/wireplumber/bluetooth.lua.d/51-obs-e2e.lua" <<EOF
+bluez_monitor.enabled = false
+EOF
+
+pipewire >"$dir/pipewire.log" 2>&1 &
+pipewire_pid=$!
+
+tries=0
+until pw-cli info 0 >/dev/null 2>&1; do
+	tries=$((tries + 1))
+	if [ $tries -gt 50 ] || ! kill -0 "$pipewire_pid" 2>/dev/null; then
+		echo "The private PipeWire instance didn't start:" >&2
+		cat "$dir/pipewire.log" >&2
+		exit 1
+	fi
+	sleep 0.1
+done
+
+wireplumber >"$dir/wireplumber.log" 2>&1 &
+wireplumber_pid=$!
+
+# WirePlumber has started once it has published the default metadata
+tries=0
+until pw-cli ls Metadata 2>/dev/null | grep -q '"default"'; do
+	tries=$((tries + 1))
+	if [ $tries -gt 50 ] || ! kill -0 "$wireplumber_pid" 2>/dev/null; then
+		echo "The private WirePlumber instance didn't start:" >&2
+		cat "$dir/wireplumber.log" >&2
+		exit 1
+	fi
+	sleep 0.1
+done
+
+status=0
+if [ -n "$data_path" ]; then
+	"$driver" "$@" "$module" "$data_path" || status=$?
+else
+	"$driver" "$@" "$module" || status=$?
+fi
+
+if [ $status -ne 0 ]; then
+	echo "pipewire-audio-e2e failed, logs of the private instance are below" >&2
+	cat "$dir/pipewire.log" "$dir/wireplumber.log" >&2
+fi
+
+exit $status
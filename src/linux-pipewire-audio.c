@@ -23,6 +23,7 @@
 #include <pipewire/pipewire.h>
 
 #include "pipewire-audio.h"
+#include "rt-audit.h"
 
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE("linux-pipewire-audio", "en-US")
@@ -35,6 +36,15 @@ bool obs_module_load(void)
 {
 	pw_init(NULL, NULL);
 
+	obs_pw_audio_profiler_register();
+
+#ifdef OBS_PW_AUDIO_ASSERT_NO_ALLOC
+	if (!obs_pw_audio_rt_audit_enter) {
+		blog(LOG_WARNING, "[pipewire-audio] Built to abort on allocations in the process callback, "
+				  "but linux-pipewire-audio-rt-audit.so isn't preloaded. Nothing will be trapped");
+	}
+#endif
+
 	pipewire_audio_capture_load();
 	pipewire_audio_capture_app_load();
 	return true;
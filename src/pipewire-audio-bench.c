@@ -0,0 +1,291 @@
+/* pipewire-audio-bench.c
+ *
+ * Copyright 2022-2026 Dimitris Papaioannou <dimtpap@protonmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/** Offline benchmark of the stream process path, built with -DENABLE_BENCH=ON.
+  * The stream wrapper is compiled in so that its process callback can be driven with synthetic buffers,
+  * without a PipeWire daemon or OBS. The few calls it makes into either are replaced below.
+  * Covers timestamping and clock tracking on every buffer, the packetiser and the fade's arena copies */
+
+#include <pipewire/version.h>
+
+#define pw_stream_dequeue_buffer bench_stream_dequeue_buffer
+#define pw_stream_queue_buffer bench_stream_queue_buffer
+#if PW_CHECK_VERSION(0, 3, 50)
+#define pw_stream_get_time_n bench_stream_get_time_n
+#else
+#define pw_stream_get_time bench_stream_get_time
+#endif
+#define pw_stream_get_core bench_stream_get_core
+#define pw_core_get_context bench_core_get_context
+#define pw_context_get_properties bench_context_get_properties
+#define obs_source_output_audio bench_source_output_audio
+
+#include "pipewire-audio.c"
+
+#include <stdio.h>
+
+#define BENCH_RATE 48000
+#define BENCH_WARMUP 1000
+#define BENCH_ITERATIONS 20000
+#define BENCH_PACKET_LATENCY_MS 20
+
+static struct {
+	struct pw_buffer buffer;
+	struct spa_buffer spa_buffer;
+	struct spa_data datas[MAX_AV_PLANES];
+	struct spa_chunk chunks[MAX_AV_PLANES];
+
+	uint32_t quantum;
+	uint64_t ticks;
+
+	uint64_t output_frames;
+	uint64_t output_packets;
+} bench;
+
+struct pw_buffer *bench_stream_dequeue_buffer(struct pw_stream *stream)
+{
+	UNUSED_PARAMETER(stream);
+
+	bench.ticks += bench.quantum;
+	return &bench.buffer;
+}
+
+int bench_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer)
+{
+	UNUSED_PARAMETER(stream);
+	UNUSED_PARAMETER(buffer);
+	return 0;
+}
+
+/* A steady clock, every buffer continues where the previous one ended */
+static void fill_time(struct pw_time *time, size_t size)
+{
+	memset(time, 0, size);
+	time->now = (int64_t)os_gettime_ns();
+	time->rate = SPA_FRACTION(1, BENCH_RATE);
+	time->ticks = bench.ticks;
+	time->delay = bench.quantum;
+}
+
+#if PW_CHECK_VERSION(0, 3, 50)
+int bench_stream_get_time_n(struct pw_stream *stream, struct pw_time *time, size_t size)
+{
+	UNUSED_PARAMETER(stream);
+
+	fill_time(time, size);
+	return 0;
+}
+#else
+int bench_stream_get_time(struct pw_stream *stream, struct pw_time *time)
+{
+	UNUSED_PARAMETER(stream);
+
+	fill_time(time, sizeof(*time));
+	return 0;
+}
+#endif
+
+struct pw_core *bench_stream_get_core(struct pw_stream *stream)
+{
+	UNUSED_PARAMETER(stream);
+	return NULL;
+}
+
+struct pw_context *bench_core_get_context(struct pw_core *core)
+{
+	UNUSED_PARAMETER(core);
+	return NULL;
+}
+
+/* The default quantum limit is used */
+const struct pw_properties *bench_context_get_properties(struct pw_context *context)
+{
+	UNUSED_PARAMETER(context);
+	return NULL;
+}
+
+void bench_source_output_audio(obs_source_t *source, const struct obs_source_audio *audio)
+{
+	UNUSED_PARAMETER(source);
+
+	bench.output_frames += audio->frames;
+	bench.output_packets++;
+}
+
+const char *obs_module_text(const char *lookup_string)
+{
+	return lookup_string;
+}
+
+struct bench_format {
+	const char *name;
+	enum spa_audio_format format;
+	uint32_t sample_size;
+	bool planar;
+};
+
+static const struct bench_format formats[] = {
+	{"f32", SPA_AUDIO_FORMAT_F32, 4, false},
+	{"f32p", SPA_AUDIO_FORMAT_F32P, 4, true},
+	{"s16", SPA_AUDIO_FORMAT_S16, 2, false},
+	{"s32p", SPA_AUDIO_FORMAT_S32P, 4, true},
+};
+
+static const uint32_t channel_counts[] = {1, 2, 6, 8};
+static const uint32_t quanta[] = {64, 256, 1024};
+
+enum bench_mode { BENCH_MODE_PROCESS, BENCH_MODE_PACKETISED, BENCH_MODE_FADE };
+static const char *mode_names[] = {"process", "packetised", "fade"};
+
+static void set_format(struct obs_pw_audio_stream *s, const struct bench_format *format, uint32_t channels)
+{
+	uint8_t pod_buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(pod_buffer, sizeof(pod_buffer));
+
+	struct spa_audio_info_raw info = {
+		.format = format->format,
+		.rate = BENCH_RATE,
+		.channels = channels,
+	};
+	const struct spa_pod *param = spa_format_audio_raw_build(&b, SPA_PARAM_Format, &info);
+
+	on_param_changed_cb(s, SPA_PARAM_Format, param);
+}
+
+static void fill_buffer(const struct bench_format *format, uint32_t channels, uint32_t quantum)
+{
+	uint32_t planes = format->planar ? channels : 1;
+	uint32_t stride = format->sample_size * (format->planar ? 1 : channels);
+
+	bench.spa_buffer.n_datas = planes;
+	bench.spa_buffer.datas = bench.datas;
+	bench.buffer.buffer = &bench.spa_buffer;
+
+	for (uint32_t i = 0; i < planes; i++) {
+		struct spa_data *d = &bench.datas[i];
+
+		bfree(d->data);
+		d->type = SPA_DATA_MemPtr;
+		d->maxsize = quantum * stride;
+		d->data = bmalloc(d->maxsize);
+		d->chunk = &bench.chunks[i];
+		d->chunk->size = quantum * stride;
+		d->chunk->stride = (int32_t)stride;
+
+		/* Anything but silence, the fade has to do real work */
+		for (uint32_t j = 0; j < d->maxsize; j++) {
+			((uint8_t *)d->data)[j] = (uint8_t)(j * 7 + i);
+		}
+	}
+}
+
+static void free_buffer(void)
+{
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		bfree(bench.datas[i].data);
+		bench.datas[i].data = NULL;
+	}
+}
+
+static void run_fade(struct obs_pw_audio_stream *s)
+{
+	struct obs_source_audio out = {
+		.frames = bench.quantum,
+		.speakers = s->info.speakers,
+		.format = s->info.format,
+		.samples_per_sec = s->info.sample_rate,
+	};
+
+	for (size_t i = 0; i < bench.spa_buffer.n_datas && i < MAX_AV_PLANES; i++) {
+		out.data[i] = bench.datas[i].data;
+	}
+
+	s->arena.used = 0;
+	fade_audio(s, &out, true);
+	bench_source_output_audio(s->output, &out);
+}
+
+static void run(const struct bench_format *format, uint32_t channels, uint32_t quantum, enum bench_mode mode)
+{
+	struct obs_pw_audio_stream s = {0};
+	struct spa_io_position position = {0};
+
+	/* Never dereferenced, every stream call is replaced */
+	s.stream = (struct pw_stream *)&bench;
+
+	position.clock.rate = SPA_FRACTION(1, BENCH_RATE);
+	position.clock.rate_diff = 1.0;
+	position.clock.duration = quantum;
+	s.pos = &position;
+
+	set_format(&s, format, channels);
+	if (mode == BENCH_MODE_PACKETISED) {
+		obs_pw_audio_stream_set_packet_latency(&s, BENCH_PACKET_LATENCY_MS);
+	}
+
+	bench.quantum = quantum;
+	bench.ticks = 0;
+	fill_buffer(format, channels, quantum);
+
+	uint64_t start = 0;
+	for (uint32_t i = 0; i < BENCH_WARMUP + BENCH_ITERATIONS; i++) {
+		if (i == BENCH_WARMUP) {
+			bench.output_frames = 0;
+			bench.output_packets = 0;
+			start = os_gettime_ns();
+		}
+
+		if (mode == BENCH_MODE_FADE) {
+			run_fade(&s);
+		} else {
+			on_process_cb(&s);
+		}
+	}
+	uint64_t elapsed = os_gettime_ns() - start;
+
+	double ns_per_callback = (double)elapsed / BENCH_ITERATIONS;
+	double frames_per_sec = (double)BENCH_ITERATIONS * quantum * SPA_NSEC_PER_SEC / (double)elapsed;
+
+	printf("%-10s %-5s %8u %8u %14.1f %16.0f %10" PRIu64 "\n", mode_names[mode], format->name, channels, quantum,
+	       ns_per_callback, frames_per_sec, bench.output_packets);
+
+	s.stream = NULL;
+	obs_pw_audio_stream_destroy(&s);
+}
+
+int main(void)
+{
+	printf("%-10s %-5s %8s %8s %14s %16s %10s\n", "mode", "fmt", "channels", "quantum", "ns/callback",
+	       "frames/s", "packets");
+
+	for (enum bench_mode mode = BENCH_MODE_PROCESS; mode <= BENCH_MODE_FADE; mode++) {
+		for (size_t f = 0; f < SPA_N_ELEMENTS(formats); f++) {
+			for (size_t c = 0; c < SPA_N_ELEMENTS(channel_counts); c++) {
+				for (size_t q = 0; q < SPA_N_ELEMENTS(quanta); q++) {
+					run(&formats[f], channel_counts[c], quanta[q], mode);
+				}
+			}
+		}
+	}
+
+	free_buffer();
+
+	return 0;
+}
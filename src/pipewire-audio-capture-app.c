@@ -23,12 +23,17 @@
 #include <spa/debug/types.h>
 
 #include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
 
 /* Source for capturing applciation audio using PipeWire */
 
+struct obs_pw_audio_capture_app;
+
 struct target_node_port {
 	const char *channel;
 	uint32_t id;
+	struct target_node *node;
 };
 
 struct target_node {
@@ -37,8 +42,9 @@ struct target_node {
 	const char *binary;
 	uint32_t client_id;
 	uint32_t id;
+	uint32_t serial;
 	struct obs_pw_audio_proxy_list ports;
-	uint32_t *p_n_nodes;
+	struct obs_pw_audio_capture_app *pwac;
 
 	struct spa_hook node_listener;
 };
@@ -47,6 +53,7 @@ struct target_client {
 	const char *app_name;
 	const char *binary;
 	uint32_t id;
+	struct obs_pw_audio_capture_app *pwac;
 
 	struct spa_hook client_listener;
 };
@@ -56,8 +63,40 @@ struct system_sink {
 	uint32_t id;
 };
 
+#define LINK_RETRY_DELAY_NS (250 * SPA_NSEC_PER_MSEC)
+#define LINK_MAX_RETRIES 5
+
+/* How long a leaving owner keeps its sink for the next owner to make its own */
+#define SHARED_SINK_HANDOVER_TIMEOUT_MS 1000
+
+enum capture_sink_link_state {
+	/** Created on the next core sync. The ports of a new node arrive as separate globals,
+	  * waiting lets all of them be linked at once */
+	LINK_STATE_QUEUED,
+	LINK_STATE_PENDING,
+	LINK_STATE_PAUSED,
+	LINK_STATE_ACTIVE,
+	/* Waiting to be retried, or given up on */
+	LINK_STATE_FAILED,
+};
+
+/** Link from a target port to a capture sink port, identified by the two ports.
+  * The proxy only lives as long as the remote link does, the state is kept here
+  * so that links that failed or were removed by the remote can be retried */
 struct capture_sink_link {
+	struct target_node *node;
+	uint32_t output_port;
+	uint32_t input_port;
+
+	/* Failed links are retried with exponential backoff */
+	enum capture_sink_link_state state;
+	uint32_t attempts;
+	uint64_t retry_time;
+
+	struct pw_proxy *proxy;
 	uint32_t id;
+	struct spa_hook proxy_listener;
+	struct spa_hook link_listener;
 };
 
 struct capture_sink_port {
@@ -65,8 +104,27 @@ struct capture_sink_port {
 	uint32_t id;
 };
 
+/** An app capture sink shared by all sources whose selections are equivalent.
+  * The owner creates the sink and its links, the rest only stream from it */
+struct shared_capture_sink {
+	char *key;
+
+	struct obs_pw_audio_capture_app *owner;
+	DARRAY(struct obs_pw_audio_capture_app *) followers;
+
+	/* Published by the owner once its sink is ready */
+	bool ready;
+	uint32_t id;
+	uint32_t serial;
+	uint32_t channels;
+
+	/* Whether any app is linked to the sink, nothing runs it otherwise */
+	bool linked;
+};
+
 enum capture_mode { CAPTURE_MODE_SINGLE, CAPTURE_MODE_MULTIPLE };
 enum match_priority { MATCH_PRIORITY_BINARY_NAME, MATCH_PRIORITY_APP_NAME };
+enum sink_layout { SINK_LAYOUT_OBS_OUTPUT, SINK_LAYOUT_DEFAULT_SINK };
 
 #define SETTING_CAPTURE_MODE "CaptureMode"
 #define SETTING_MATCH_PRIORITY "MatchPriorty"
@@ -75,19 +133,38 @@ enum match_priority { MATCH_PRIORITY_BINARY_NAME, MATCH_PRIORITY_APP_NAME };
 #define SETTING_SELECTION_MULTIPLE "apps"
 #define SETTING_AVAILABLE_APPS "AppToAdd"
 #define SETTING_ADD_TO_SELECTIONS "AddToSelected"
+#define SETTING_SINK_LAYOUT "SinkLayout"
+#define SETTING_PACKET_LATENCY "PacketLatency"
+#define SETTING_LOCK_MEMORY "LockMemory"
+#define SETTING_COMPENSATE_LATENCY "CompensateLatency"
+
+static const char *profile_global = OBS_PW_AUDIO_PROFILE_NAME("app registry global");
+static const char *profile_finalize_capture_sink = OBS_PW_AUDIO_PROFILE_NAME("finalize app capture sink");
+static const char *profile_connect_targets = OBS_PW_AUDIO_PROFILE_NAME("connect app capture targets");
 
 /** This source basically works like this:
     - Keep track of output streams and their ports, system sinks and the default sink
 
-    - Keep track of the channels of the default system sink and create a new virtual sink,
-      destroying the previously made one, with the same channels, then connect the stream to it
+    - Create a new virtual sink with the speaker layout of OBS, or with the channels
+      of the default system sink, then connect the stream to it. The sink keeps that layout
+      when the default sink changes
 
     - Connect any registered or new stream ports to the sink
+
+    - Sources with equivalent selections share one sink, only the first of them
+      creates it and its links, the others just connect their stream to it.
+      The sink goes away with its owner's connection, so nothing is left behind if OBS crashes.
+      When the owner leaves, the next one makes its own sink and links,
+      the previous sink is kept until then so the others can move over to it
+
+    - A single app is captured by connecting the stream straight to its output stream node,
+      no sink is needed unless the app has more than one stream
 */
 struct obs_pw_audio_capture_app {
 	obs_source_t *source;
 
 	struct obs_pw_audio_instance pw;
+	struct spa_hook core_listener;
 
 	/** The app capture sink automatically mixes
 	  * the audio of all the app streams */
@@ -98,27 +175,56 @@ struct obs_pw_audio_capture_app {
 		uint32_t id;
 		uint32_t serial;
 		uint32_t channels;
-		struct dstr position;
 		DARRAY(struct capture_sink_port) ports;
 
-		/* Links between app streams and the capture sink */
-		struct obs_pw_audio_proxy_list links;
+		DARRAY(struct capture_sink_link *) links;
+		bool links_queued;
+		int pending_links_seq;
+
+		struct spa_source *retry_timer;
+		uint64_t retry_time;
 	} sink;
 
-	/** Need the default system sink to create
-	  * the app capture sink with the same audio channels */
+	/** Need the default system sink to create the app
+	  * capture sink with the same audio channels, if so configured */
 	struct obs_pw_audio_proxy_list system_sinks;
 	struct {
 		struct obs_pw_audio_default_node_metadata metadata;
 		struct pw_proxy *proxy;
 		struct spa_hook node_listener;
 		struct spa_hook proxy_listener;
+		struct dstr name;
+
+		/* Layout the app capture sink is created with */
+		uint32_t channels;
+		struct dstr position;
+		/** Set once the layout was parsed from the default sink's format or taken from OBS.
+		  * Later default sink changes don't rebuild the capture sink,
+		  * PipeWire converts the app streams to the existing layout */
+		bool layout_fixed;
 	} default_sink;
 
+	enum sink_layout sink_layout;
+
+	struct {
+		struct shared_capture_sink *group;
+		struct spa_source *event;
+		uint32_t connected_serial;
+	} shared;
+
+	/* Capturing a single app stream node without the app capture sink */
+	struct {
+		bool enabled;
+		uint32_t connected_serial;
+		/* Whether the stream is set to capture a sink or the app stream node */
+		bool stream_capture_sink;
+	} direct;
+
 	struct obs_pw_audio_proxy_list clients;
 
 	struct obs_pw_audio_proxy_list nodes;
-	uint32_t n_nodes;
+
+	struct obs_pw_audio_target_publisher targets_snapshot;
 
 	enum capture_mode capture_mode;
 	enum match_priority match_priority;
@@ -126,6 +232,16 @@ struct obs_pw_audio_capture_app {
 	DARRAY(const char *) selections;
 };
 
+static pthread_mutex_t shared_sinks_mutex;
+/* Broadcast when a group publishes its sink or goes away, see wait_for_new_sink_locked */
+static pthread_cond_t shared_sinks_cond;
+static DARRAY(struct shared_capture_sink *) shared_sinks;
+
+static void shared_sink_publish(struct obs_pw_audio_capture_app *pwac, bool ready);
+static void shared_sink_update_linked(struct obs_pw_audio_capture_app *pwac);
+static void update_capture_path(struct obs_pw_audio_capture_app *pwac);
+static void remove_node_links(struct obs_pw_audio_capture_app *pwac, struct target_node *node, uint32_t port_id);
+
 /* System sinks */
 static void system_sink_destroy_cb(void *data)
 {
@@ -157,6 +273,8 @@ static void client_destroy_cb(void *data)
 	bfree((void *)client->binary);
 
 	spa_hook_remove(&client->client_listener);
+
+	obs_pw_audio_target_publisher_invalidate(&client->pwac->targets_snapshot);
 }
 
 static void on_client_info_cb(void *data, const struct pw_client_info *info)
@@ -173,6 +291,8 @@ static void on_client_info_cb(void *data, const struct pw_client_info *info)
 	struct target_client *client = data;
 	bfree((void *)client->binary);
 	client->binary = bstrdup(binary);
+
+	obs_pw_audio_target_publisher_invalidate(&client->pwac->targets_snapshot);
 }
 
 static const struct pw_client_events client_events = {
@@ -192,8 +312,10 @@ static void register_target_client(struct obs_pw_audio_capture_app *pwac, uint32
 	client->binary = NULL;
 	client->app_name = bstrdup(app_name);
 	client->id = global_id;
+	client->pwac = pwac;
 
 	obs_pw_audio_proxy_list_append(&pwac->clients, client_proxy);
+	obs_pw_audio_target_publisher_invalidate(&pwac->targets_snapshot);
 	pw_proxy_add_object_listener(client_proxy, &client->client_listener, &client_events, client);
 }
 
@@ -201,22 +323,40 @@ static void register_target_client(struct obs_pw_audio_capture_app *pwac, uint32
 static void port_destroy_cb(void *data)
 {
 	struct target_node_port *p = data;
+
+	remove_node_links(p->node->pwac, p->node, p->id);
+
 	bfree((void *)p->channel);
 }
 
 static void node_destroy_cb(void *data)
 {
 	struct target_node *node = data;
+	struct obs_pw_audio_capture_app *pwac = node->pwac;
 
 	spa_hook_remove(&node->node_listener);
 
+	remove_node_links(pwac, node, SPA_ID_INVALID);
+
 	obs_pw_audio_proxy_list_clear(&node->ports);
 
-	(*node->p_n_nodes)--;
+	obs_pw_audio_target_publisher_invalidate(&pwac->targets_snapshot);
+
+	if (node->serial == pwac->direct.connected_serial) {
+		if (pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+			pw_stream_disconnect(pwac->pw.audio.stream);
+		}
+		pwac->direct.connected_serial = SPA_ID_INVALID;
+	}
 
 	bfree((void *)node->binary);
 	bfree((void *)node->app_name);
 	bfree((void *)node->name);
+
+	if (pwac->direct.enabled) {
+		/* The node is already out of the list, retarget to the remaining app streams */
+		update_capture_path(pwac);
+	}
 }
 
 static struct target_node_port *node_register_port(struct target_node *node, uint32_t global_id,
@@ -231,6 +371,7 @@ static struct target_node_port *node_register_port(struct target_node *node, uin
 	struct target_node_port *port = pw_proxy_get_user_data(port_proxy);
 	port->channel = bstrdup(channel);
 	port->id = global_id;
+	port->node = node;
 
 	obs_pw_audio_proxy_list_append(&node->ports, port_proxy);
 
@@ -251,6 +392,12 @@ static void on_node_info_cb(void *data, const struct pw_node_info *info)
 	struct target_node *node = data;
 	bfree((void *)node->binary);
 	node->binary = bstrdup(binary);
+
+	obs_pw_audio_target_publisher_invalidate(&node->pwac->targets_snapshot);
+
+	if (node->pwac->direct.enabled) {
+		update_capture_path(node->pwac);
+	}
 }
 
 static const struct pw_node_events node_events = {
@@ -258,8 +405,8 @@ static const struct pw_node_events node_events = {
 	.info = on_node_info_cb,
 };
 
-static void register_target_node(struct obs_pw_audio_capture_app *pwac, uint32_t global_id, uint32_t client_id,
-				 const char *app_name, const char *name)
+static void register_target_node(struct obs_pw_audio_capture_app *pwac, uint32_t global_id, uint32_t object_serial,
+				 uint32_t client_id, const char *app_name, const char *name)
 {
 	struct pw_proxy *node_proxy = pw_registry_bind(pwac->pw.registry, global_id, PW_TYPE_INTERFACE_Node,
 						       PW_VERSION_NODE, sizeof(struct target_node));
@@ -272,14 +419,18 @@ static void register_target_node(struct obs_pw_audio_capture_app *pwac, uint32_t
 	node->app_name = bstrdup(app_name);
 	node->binary = NULL;
 	node->id = global_id;
+	node->serial = object_serial;
 	node->client_id = client_id;
-	node->p_n_nodes = &pwac->n_nodes;
+	node->pwac = pwac;
 	obs_pw_audio_proxy_list_init(&node->ports, NULL, port_destroy_cb);
 
-	pwac->n_nodes++;
-
 	obs_pw_audio_proxy_list_append(&pwac->nodes, node_proxy);
+	obs_pw_audio_target_publisher_invalidate(&pwac->targets_snapshot);
 	pw_proxy_add_object_listener(node_proxy, &node->node_listener, &node_events, node);
+
+	if (pwac->direct.enabled) {
+		update_capture_path(pwac);
+	}
 }
 
 static bool node_is_targeted(struct obs_pw_audio_capture_app *pwac, struct target_node *node)
@@ -311,22 +462,282 @@ static bool node_is_targeted(struct obs_pw_audio_capture_app *pwac, struct targe
 /* ------------------------------------------------- */
 
 /* App streams <-> Capture sink links */
-static void link_bound_cb(void *data, uint32_t global_id)
+static void set_link_state(struct capture_sink_link *link, enum capture_sink_link_state state)
+{
+	if (link->state != state) {
+		link->state = state;
+		obs_pw_audio_target_publisher_invalidate(&link->node->pwac->targets_snapshot);
+		shared_sink_update_linked(link->node->pwac);
+	}
+}
+
+static struct capture_sink_link *find_link(struct obs_pw_audio_capture_app *pwac, uint32_t output_port,
+					   uint32_t input_port)
+{
+	for (size_t i = 0; i < pwac->sink.links.num; i++) {
+		struct capture_sink_link *link = pwac->sink.links.array[i];
+		if (link->output_port == output_port && link->input_port == input_port) {
+			return link;
+		}
+	}
+
+	return NULL;
+}
+
+static void remove_link(struct obs_pw_audio_capture_app *pwac, size_t idx)
+{
+	struct capture_sink_link *link = pwac->sink.links.array[idx];
+
+	if (link->proxy) {
+		pw_proxy_destroy(link->proxy);
+	}
+
+	da_erase(pwac->sink.links, idx);
+	bfree(link);
+
+	obs_pw_audio_target_publisher_invalidate(&pwac->targets_snapshot);
+	shared_sink_update_linked(pwac);
+}
+
+/** Forget the links of a node, or of one of its ports if port_id isn't SPA_ID_INVALID */
+static void remove_node_links(struct obs_pw_audio_capture_app *pwac, struct target_node *node, uint32_t port_id)
+{
+	for (size_t i = pwac->sink.links.num; i > 0; i--) {
+		struct capture_sink_link *link = pwac->sink.links.array[i - 1];
+		if (link->node == node && (port_id == SPA_ID_INVALID || link->output_port == port_id)) {
+			remove_link(pwac, i - 1);
+		}
+	}
+}
+
+static void remove_all_links(struct obs_pw_audio_capture_app *pwac)
+{
+	for (size_t i = pwac->sink.links.num; i > 0; i--) {
+		remove_link(pwac, i - 1);
+	}
+
+	pwac->sink.links_queued = false;
+}
+
+static void schedule_link_retry(struct obs_pw_audio_capture_app *pwac, uint64_t time)
+{
+	if (pwac->sink.retry_time && pwac->sink.retry_time <= time) {
+		/* Timer will fire earlier, it reschedules for the rest */
+		return;
+	}
+
+	pwac->sink.retry_time = time;
+
+	struct timespec ts = {
+		.tv_sec = time / SPA_NSEC_PER_SEC,
+		.tv_nsec = time % SPA_NSEC_PER_SEC,
+	};
+	pw_loop_update_timer(pw_thread_loop_get_loop(pwac->pw.thread_loop), pwac->sink.retry_timer, &ts, NULL, true);
+}
+
+/** The proxy of a failed link is kept until the retry, it may be destroyed from its own events */
+static void link_failed(struct capture_sink_link *link, const char *error)
+{
+	if (link->state == LINK_STATE_FAILED) {
+		return;
+	}
+
+	set_link_state(link, LINK_STATE_FAILED);
+
+	if (link->attempts >= LINK_MAX_RETRIES) {
+		blog(LOG_WARNING,
+		     "[pipewire-audio] Link from port %u of node %u to app capture sink failed: %s. Giving up after %u retries",
+		     link->output_port, link->node->id, error, link->attempts);
+		return;
+	}
+
+	uint64_t delay = LINK_RETRY_DELAY_NS << link->attempts;
+	link->retry_time = os_gettime_ns() + delay;
+
+	blog(LOG_WARNING,
+	     "[pipewire-audio] Link from port %u of node %u to app capture sink failed: %s. Retrying in %" PRIu64 " ms",
+	     link->output_port, link->node->id, error, delay / SPA_NSEC_PER_MSEC);
+
+	schedule_link_retry(link->node->pwac, link->retry_time);
+}
+
+static void on_link_proxy_bound_cb(void *data, uint32_t global_id)
 {
 	struct capture_sink_link *link = data;
 	link->id = global_id;
 }
 
-static void link_destroy_cb(void *data)
+/** The remote destroyed the link, e.g. a session manager or patchbay unlinked it */
+static void on_link_proxy_removed_cb(void *data)
 {
 	struct capture_sink_link *link = data;
+
+	link_failed(link, "removed by the PipeWire remote");
+
+	pw_proxy_destroy(link->proxy);
+}
+
+static void on_link_proxy_destroy_cb(void *data)
+{
+	struct capture_sink_link *link = data;
+
+	spa_hook_remove(&link->proxy_listener);
+	spa_hook_remove(&link->link_listener);
+
 	blog(LOG_DEBUG, "[pipewire-audio] Link %u destroyed", link->id);
+
+	link->proxy = NULL;
+	link->id = SPA_ID_INVALID;
 }
 
-static void link_port_to_sink(struct obs_pw_audio_capture_app *pwac, struct target_node_port *port, uint32_t node_id)
+static void on_link_proxy_error_cb(void *data, int seq, int res, const char *message)
 {
-	blog(LOG_DEBUG, "[pipewire-audio] Connecting port %u of node %u to app capture sink", port->id, node_id);
+	UNUSED_PARAMETER(seq);
+	link_failed(data, message ? message : spa_strerror(res));
+}
+
+static const struct pw_proxy_events link_proxy_events = {
+	PW_VERSION_PROXY_EVENTS,
+	.bound = on_link_proxy_bound_cb,
+	.removed = on_link_proxy_removed_cb,
+	.destroy = on_link_proxy_destroy_cb,
+	.error = on_link_proxy_error_cb,
+};
+
+static void on_link_info_cb(void *data, const struct pw_link_info *info)
+{
+	if ((info->change_mask & PW_LINK_CHANGE_MASK_STATE) == 0) {
+		return;
+	}
+
+	struct capture_sink_link *link = data;
+
+	switch (info->state) {
+	case PW_LINK_STATE_ERROR:
+		link_failed(link, info->error ? info->error : "unknown error");
+		break;
+	case PW_LINK_STATE_PAUSED:
+		set_link_state(link, LINK_STATE_PAUSED);
+		break;
+	case PW_LINK_STATE_ACTIVE:
+		set_link_state(link, LINK_STATE_ACTIVE);
+		link->attempts = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+static const struct pw_link_events link_events = {
+	PW_VERSION_LINK_EVENTS,
+	.info = on_link_info_cb,
+};
 
+static void create_link(struct obs_pw_audio_capture_app *pwac, struct capture_sink_link *link)
+{
+	struct pw_properties *link_props = pw_properties_new(PW_KEY_OBJECT_LINGER, "false", NULL);
+
+	pw_properties_setf(link_props, PW_KEY_LINK_OUTPUT_NODE, "%u", link->node->id);
+	pw_properties_setf(link_props, PW_KEY_LINK_OUTPUT_PORT, "%u", link->output_port);
+
+	pw_properties_setf(link_props, PW_KEY_LINK_INPUT_NODE, "%u", pwac->sink.id);
+	pw_properties_setf(link_props, PW_KEY_LINK_INPUT_PORT, "%u", link->input_port);
+
+	link->proxy = pw_core_create_object(pwac->pw.core, "link-factory", PW_TYPE_INTERFACE_Link, PW_VERSION_LINK,
+					    &link_props->dict, 0);
+
+	pw_properties_free(link_props);
+
+	if (!link->proxy) {
+		link_failed(link, "could not create the link");
+		return;
+	}
+
+	link->id = SPA_ID_INVALID;
+	set_link_state(link, LINK_STATE_PENDING);
+
+	spa_zero(link->proxy_listener);
+	spa_zero(link->link_listener);
+	pw_proxy_add_listener(link->proxy, &link->proxy_listener, &link_proxy_events, link);
+	pw_proxy_add_object_listener(link->proxy, &link->link_listener, &link_events, link);
+}
+
+static void flush_pending_links(struct obs_pw_audio_capture_app *pwac)
+{
+	pwac->sink.links_queued = false;
+
+	size_t created = 0;
+	for (size_t i = 0; i < pwac->sink.links.num; i++) {
+		struct capture_sink_link *link = pwac->sink.links.array[i];
+		if (link->state == LINK_STATE_QUEUED) {
+			create_link(pwac, link);
+			created++;
+		}
+	}
+
+	if (created) {
+		blog(LOG_DEBUG, "[pipewire-audio] Created %zu links to app capture sink", created);
+	}
+}
+
+static void queue_link(struct obs_pw_audio_capture_app *pwac, struct capture_sink_link *link)
+{
+	if (!pwac->sink.links_queued) {
+		pwac->sink.pending_links_seq = pw_core_sync(pwac->pw.core, PW_ID_CORE, pwac->sink.pending_links_seq);
+		pwac->sink.links_queued = true;
+	}
+
+	set_link_state(link, LINK_STATE_QUEUED);
+}
+
+static void on_link_retry_timer_cb(void *data, uint64_t expirations)
+{
+	UNUSED_PARAMETER(expirations);
+
+	struct obs_pw_audio_capture_app *pwac = data;
+
+	pwac->sink.retry_time = 0;
+
+	uint64_t now = os_gettime_ns();
+
+	for (size_t i = 0; i < pwac->sink.links.num; i++) {
+		struct capture_sink_link *link = pwac->sink.links.array[i];
+		if (link->state != LINK_STATE_FAILED || link->attempts >= LINK_MAX_RETRIES) {
+			continue;
+		}
+
+		if (link->retry_time > now) {
+			schedule_link_retry(pwac, link->retry_time);
+			continue;
+		}
+
+		if (link->proxy) {
+			pw_proxy_destroy(link->proxy);
+		}
+
+		link->attempts++;
+		queue_link(pwac, link);
+	}
+}
+
+static void count_links(struct obs_pw_audio_capture_app *pwac, size_t *active, size_t *failed)
+{
+	*active = 0;
+	*failed = 0;
+
+	for (size_t i = 0; i < pwac->sink.links.num; i++) {
+		struct capture_sink_link *link = pwac->sink.links.array[i];
+		if (link->state == LINK_STATE_ACTIVE) {
+			(*active)++;
+		} else if (link->state == LINK_STATE_FAILED) {
+			(*failed)++;
+		}
+	}
+}
+
+static void link_port_to_sink(struct obs_pw_audio_capture_app *pwac, struct target_node_port *port,
+			      struct target_node *node)
+{
 	uint32_t p = 0;
 	if (pwac->sink.channels == 1 && /* Mono capture sink */
 	    pwac->sink.ports.num >= 1) {
@@ -343,34 +754,25 @@ static void link_port_to_sink(struct obs_pw_audio_capture_app *pwac, struct targ
 	if (!p) {
 		blog(LOG_WARNING,
 		     "[pipewire-audio] Could not connect port %u of node %u to app capture sink. No port of app capture sink has channel %s",
-		     port->id, node_id, port->channel);
+		     port->id, node->id, port->channel);
 		return;
 	}
 
-	struct pw_properties *link_props = pw_properties_new(PW_KEY_OBJECT_LINGER, "false", NULL);
-
-	pw_properties_setf(link_props, PW_KEY_LINK_OUTPUT_NODE, "%u", node_id);
-	pw_properties_setf(link_props, PW_KEY_LINK_OUTPUT_PORT, "%u", port->id);
-
-	pw_properties_setf(link_props, PW_KEY_LINK_INPUT_NODE, "%u", pwac->sink.id);
-	pw_properties_setf(link_props, PW_KEY_LINK_INPUT_PORT, "%u", p);
-
-	struct pw_proxy *link_proxy = pw_core_create_object(pwac->pw.core, "link-factory", PW_TYPE_INTERFACE_Link,
-							    PW_VERSION_LINK, &link_props->dict,
-							    sizeof(struct capture_sink_link));
-
-	pw_properties_free(link_props);
-
-	if (!link_proxy) {
-		blog(LOG_WARNING, "[pipewire-audio] Could not connect port %u of node %u to app capture sink", port->id,
-		     node_id);
+	if (find_link(pwac, port->id, p)) {
 		return;
 	}
 
-	struct capture_sink_link *link = pw_proxy_get_user_data(link_proxy);
+	blog(LOG_DEBUG, "[pipewire-audio] Connecting port %u of node %u to app capture sink", port->id, node->id);
+
+	struct capture_sink_link *link = bzalloc(sizeof(struct capture_sink_link));
+	link->node = node;
+	link->output_port = port->id;
+	link->input_port = p;
 	link->id = SPA_ID_INVALID;
+	da_push_back(pwac->sink.links, &link);
 
-	obs_pw_audio_proxy_list_append(&pwac->sink.links, link_proxy);
+	queue_link(pwac, link);
+	obs_pw_audio_target_publisher_invalidate(&pwac->targets_snapshot);
 }
 
 static void link_node_to_sink(struct obs_pw_audio_capture_app *pwac, struct target_node *node)
@@ -380,173 +782,708 @@ static void link_node_to_sink(struct obs_pw_audio_capture_app *pwac, struct targ
 
 	struct target_node_port *port;
 	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&port)) {
-		link_port_to_sink(pwac, port, node->id);
+		link_port_to_sink(pwac, port, node);
+	}
+}
+
+static void on_core_done_cb(void *data, uint32_t id, int seq)
+{
+	struct obs_pw_audio_capture_app *pwac = data;
+
+	if (id == PW_ID_CORE && seq == pwac->sink.pending_links_seq) {
+		flush_pending_links(pwac);
+	}
+}
+
+static const struct pw_core_events core_events = {
+	PW_VERSION_CORE_EVENTS,
+	.done = on_core_done_cb,
+};
+/* ------------------------------------------------- */
+
+/* App capture sink */
+
+/** The app capture sink is created when its layout is known.
+  * See the on_metadata and on_default_sink callbacks */
+static void connect_targets(struct obs_pw_audio_capture_app *pwac)
+{
+	if (!pwac->sink.proxy) {
+		return;
+	}
+
+	profile_start(profile_connect_targets);
+
+	/* Links that are still wanted are kept, see link_port_to_sink */
+	struct obs_pw_audio_proxy_list_iter iter;
+	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->nodes);
+
+	struct target_node *node;
+	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&node)) {
+		if (pwac->selections.num != 0 && node_is_targeted(pwac, node)) {
+			link_node_to_sink(pwac, node);
+		} else {
+			remove_node_links(pwac, node, SPA_ID_INVALID);
+		}
+	}
+
+	profile_end(profile_connect_targets);
+}
+
+static void finalize_capture_sink(struct obs_pw_audio_capture_app *pwac)
+{
+	if (!pwac->sink.proxy || pwac->sink.id == SPA_ID_INVALID || pwac->sink.serial == SPA_ID_INVALID ||
+	    pwac->sink.ports.num != pwac->sink.channels) {
+		return;
+	}
+
+	profile_start(profile_finalize_capture_sink);
+
+	blog(LOG_DEBUG, "[pipewire-audio] App capture sink ready");
+
+	/* Promoted from follower, the stream stayed on the previous owner's sink until now */
+	if (pwac->shared.connected_serial != SPA_ID_INVALID) {
+		if (pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+			pw_stream_disconnect(pwac->pw.audio.stream);
+		}
+		pwac->shared.connected_serial = SPA_ID_INVALID;
+	}
+
+	connect_targets(pwac);
+
+	pwac->sink.autoconnect_targets = true;
+
+	if (obs_pw_audio_stream_connect(&pwac->pw.audio, pwac->sink.id, pwac->sink.serial, pwac->sink.channels) < 0) {
+		blog(LOG_WARNING, "[pipewire-audio] Error connecting stream %p to app capture sink %u",
+		     pwac->pw.audio.stream, pwac->sink.id);
+	}
+
+	shared_sink_publish(pwac, true);
+
+	profile_end(profile_finalize_capture_sink);
+}
+
+static void on_sink_proxy_bound_cb(void *data, uint32_t global_id)
+{
+	struct obs_pw_audio_capture_app *pwac = data;
+	pwac->sink.id = global_id;
+}
+
+static void free_capture_sink_ports(struct capture_sink_port *ports, size_t num)
+{
+	for (size_t i = 0; i < num; i++) {
+		bfree((void *)ports[i].channel);
+	}
+}
+
+static void on_sink_proxy_removed_cb(void *data)
+{
+	struct obs_pw_audio_capture_app *pwac = data;
+	blog(LOG_WARNING, "[pipewire-audio] App capture sink %u has been destroyed by the PipeWire remote",
+	     pwac->sink.id);
+	pw_proxy_destroy(pwac->sink.proxy);
+}
+
+static void on_sink_proxy_destroy_cb(void *data)
+{
+	struct obs_pw_audio_capture_app *pwac = data;
+
+	shared_sink_publish(pwac, false);
+
+	spa_hook_remove(&pwac->sink.proxy_listener);
+	spa_zero(pwac->sink.proxy_listener);
+
+	free_capture_sink_ports(pwac->sink.ports.array, pwac->sink.ports.num);
+	da_free(pwac->sink.ports);
+
+	pwac->sink.channels = 0;
+
+	/* The remote links are destroyed by PipeWire along with the sink */
+	remove_all_links(pwac);
+
+	pwac->sink.autoconnect_targets = false;
+	pwac->sink.proxy = NULL;
+
+	blog(LOG_DEBUG, "[pipewire-audio] App capture sink %u destroyed", pwac->sink.id);
+
+	pwac->sink.id = SPA_ID_INVALID;
+}
+
+static void on_sink_proxy_error_cb(void *data, int seq, int res, const char *message)
+{
+	UNUSED_PARAMETER(data);
+	blog(LOG_ERROR, "[pipewire-audio] App capture sink error: seq:%d res:%d :%s", seq, res, message);
+}
+
+static const struct pw_proxy_events sink_proxy_events = {
+	PW_VERSION_PROXY_EVENTS,
+	.bound = on_sink_proxy_bound_cb,
+	.removed = on_sink_proxy_removed_cb,
+	.destroy = on_sink_proxy_destroy_cb,
+	.error = on_sink_proxy_error_cb,
+};
+
+static void register_capture_sink_port(struct obs_pw_audio_capture_app *pwac, uint32_t global_id, const char *channel)
+{
+	blog(LOG_DEBUG, "[pipewire-audio] Registering app capture sink port %u", global_id);
+
+	struct capture_sink_port *port = da_push_back_new(pwac->sink.ports);
+	port->channel = bstrdup(channel);
+	port->id = global_id;
+
+	finalize_capture_sink(pwac);
+}
+
+/** The sink doesn't linger, PipeWire destroys it along with its proxy or when the connection is lost.
+  * Each owner makes its own, so it's always named after the source that owns it */
+static void make_capture_sink(struct obs_pw_audio_capture_app *pwac, uint32_t channels, const char *position)
+{
+	struct pw_properties *sink_props = pw_properties_new(PW_KEY_FACTORY_NAME, "support.null-audio-sink",
+							     PW_KEY_MEDIA_CLASS, "Stream/Input/Audio",
+							     PW_KEY_NODE_VIRTUAL, "true", PW_KEY_OBJECT_LINGER, "false",
+							     SPA_KEY_AUDIO_POSITION, position, NULL);
+
+	pw_properties_setf(sink_props, PW_KEY_NODE_NAME, "OBS: %s", obs_source_get_name(pwac->source));
+
+	pw_properties_setf(sink_props, PW_KEY_AUDIO_CHANNELS, "%u", channels);
+
+	pwac->sink.proxy =
+		pw_core_create_object(pwac->pw.core, "adapter", PW_TYPE_INTERFACE_Node, PW_VERSION_NODE, &sink_props->dict, 0);
+
+	pw_properties_free(sink_props);
+
+	if (!pwac->sink.proxy) {
+		blog(LOG_WARNING, "[pipewire-audio] Failed to create app capture sink");
+		return;
+	}
+
+	pwac->sink.channels = channels;
+
+	pwac->sink.id = SPA_ID_INVALID;
+	pwac->sink.serial = SPA_ID_INVALID;
+
+	pw_proxy_add_listener(pwac->sink.proxy, &pwac->sink.proxy_listener, &sink_proxy_events, pwac);
+
+	blog(LOG_DEBUG, "[pipewire-audio] Created app capture sink");
+}
+
+/** PipeWire destroys the sink along with its proxy, and the links with the sink */
+static void destroy_capture_sink(struct obs_pw_audio_capture_app *pwac)
+{
+	if (!pwac->sink.proxy) {
+		return;
+	}
+
+	if (pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+		pw_stream_disconnect(pwac->pw.audio.stream);
+	}
+
+	pwac->sink.autoconnect_targets = false;
+	pw_proxy_destroy(pwac->sink.proxy);
+}
+/* ------------------------------------------------- */
+
+/* Shared capture sinks */
+
+/** Sources run on separate PipeWire connections and thread loops.
+  * Group state is guarded by shared_sinks_mutex and members are notified
+  * through an event on their own loop, so no thread loop is ever locked
+  * by another source. PipeWire is only called with the mutex unlocked,
+  * members act on a copy of the group state. */
+static void signal_shared_sink_member(struct obs_pw_audio_capture_app *member)
+{
+	pw_loop_signal_event(pw_thread_loop_get_loop(member->pw.thread_loop), member->shared.event);
+}
+
+static void shared_sink_publish(struct obs_pw_audio_capture_app *pwac, bool ready)
+{
+	pthread_mutex_lock(&shared_sinks_mutex);
+
+	struct shared_capture_sink *group = pwac->shared.group;
+	if (group && group->owner == pwac) {
+		group->ready = ready;
+		group->id = pwac->sink.id;
+		group->serial = pwac->sink.serial;
+		group->channels = pwac->sink.channels;
+
+		for (size_t i = 0; i < group->followers.num; i++) {
+			signal_shared_sink_member(group->followers.array[i]);
+		}
+		pthread_cond_broadcast(&shared_sinks_cond);
+	}
+
+	pthread_mutex_unlock(&shared_sinks_mutex);
+}
+
+/** Followers can't see the owner's links, so the owner keeps the group's idea of them current */
+static void shared_sink_update_linked(struct obs_pw_audio_capture_app *pwac)
+{
+	bool linked = false;
+	for (size_t i = 0; i < pwac->sink.links.num; i++) {
+		if (pwac->sink.links.array[i]->state != LINK_STATE_FAILED) {
+			linked = true;
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&shared_sinks_mutex);
+
+	struct shared_capture_sink *group = pwac->shared.group;
+	if (group && group->owner == pwac) {
+		group->linked = linked;
+	}
+
+	pthread_mutex_unlock(&shared_sinks_mutex);
+}
+
+static bool shared_sink_is_owner(struct obs_pw_audio_capture_app *pwac)
+{
+	pthread_mutex_lock(&shared_sinks_mutex);
+	bool is_owner = pwac->shared.group && pwac->shared.group->owner == pwac;
+	pthread_mutex_unlock(&shared_sinks_mutex);
+
+	return is_owner;
+}
+
+static int cmp_selections(const void *a, const void *b)
+{
+	return astrcmpi(*(const char **)a, *(const char **)b);
+}
+
+/** Selections are matched case insensitively and in any order,
+  * so the key is the sorted, deduplicated and lowercased selections */
+static void build_selections_key(struct obs_pw_audio_capture_app *pwac, struct dstr *key)
+{
+	DARRAY(const char *) sorted;
+	da_init(sorted);
+	da_copy(sorted, pwac->selections);
+
+	qsort(sorted.array, sorted.num, sizeof(const char *), cmp_selections);
+
+	dstr_printf(key, "%d %s", pwac->sink_layout, pwac->except ? "except" : "only");
+
+	for (size_t i = 0; i < sorted.num; i++) {
+		if (i == 0 || astrcmpi(sorted.array[i - 1], sorted.array[i]) != 0) {
+			dstr_cat_ch(key, '\n');
+			dstr_cat(key, sorted.array[i]);
+		}
+	}
+
+	dstr_to_lower(key);
+
+	da_free(sorted);
+}
+
+static bool shared_sink_exists_locked(struct shared_capture_sink *group)
+{
+	for (size_t i = 0; i < shared_sinks.num; i++) {
+		if (shared_sinks.array[i] == group) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Wait for the new owner of a group to publish its own sink, the group's streams are still on the previous one.
+  * Gives up once the group is gone or after SHARED_SINK_HANDOVER_TIMEOUT_MS, then the followers are told
+  * the previous sink is going away
+  * @warning Call with shared_sinks_mutex locked */
+static void wait_for_new_sink_locked(struct shared_capture_sink *group, uint32_t previous_serial)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += SHARED_SINK_HANDOVER_TIMEOUT_MS / 1000;
+	deadline.tv_nsec += (SHARED_SINK_HANDOVER_TIMEOUT_MS % 1000) * SPA_NSEC_PER_MSEC;
+	if (deadline.tv_nsec >= SPA_NSEC_PER_SEC) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= SPA_NSEC_PER_SEC;
+	}
+
+	while (shared_sink_exists_locked(group) && !(group->ready && group->serial != previous_serial)) {
+		if (pthread_cond_timedwait(&shared_sinks_cond, &shared_sinks_mutex, &deadline) != ETIMEDOUT) {
+			continue;
+		}
+
+		blog(LOG_WARNING, "[pipewire-audio] Timed out handing app capture sink %u over", previous_serial);
+
+		if (group->serial == previous_serial) {
+			group->ready = false;
+			group->linked = false;
+			for (size_t i = 0; i < group->followers.num; i++) {
+				signal_shared_sink_member(group->followers.array[i]);
+			}
+		}
+		return;
+	}
+}
+
+/** Leave the current group, handing it over to a follower if this source owned it.
+  * The follower makes its own sink, this source's sink is destroyed once that's ready
+  * @warning Call with the thread loop locked */
+static void shared_sink_leave(struct obs_pw_audio_capture_app *pwac)
+{
+	pthread_mutex_lock(&shared_sinks_mutex);
+
+	struct shared_capture_sink *group = pwac->shared.group;
+	if (!group) {
+		pthread_mutex_unlock(&shared_sinks_mutex);
+		return;
+	}
+
+	pwac->shared.group = NULL;
+	pwac->shared.connected_serial = SPA_ID_INVALID;
+
+	bool was_follower = group->owner != pwac;
+
+	if (was_follower) {
+		da_erase_item(group->followers, &pwac);
+	} else if (group->followers.num) {
+		/* The followers are streaming from this source's sink, unless it isn't ready yet */
+		bool in_use = group->ready && pwac->sink.proxy && group->serial == pwac->sink.serial;
+		if (!in_use) {
+			group->linked = false;
+		}
+
+		group->owner = group->followers.array[0];
+		da_erase(group->followers, 0);
+
+		blog(LOG_DEBUG, "[pipewire-audio] Handing app capture sink group of \"%s\" over to \"%s\"",
+		     obs_source_get_name(pwac->source), obs_source_get_name(group->owner->source));
+
+		signal_shared_sink_member(group->owner);
+
+		if (in_use) {
+			wait_for_new_sink_locked(group, pwac->sink.serial);
+		}
+	} else {
+		da_erase_item(shared_sinks, &group);
+		pthread_cond_broadcast(&shared_sinks_cond);
+
+		da_free(group->followers);
+		bfree(group->key);
+		bfree(group);
+	}
+
+	pthread_mutex_unlock(&shared_sinks_mutex);
+
+	if (was_follower) {
+		if (pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+			pw_stream_disconnect(pwac->pw.audio.stream);
+		}
+	} else {
+		destroy_capture_sink(pwac);
+	}
+}
+
+/** The daemon the group's sink was made on went away. Every member was connected to it,
+  * so nobody waits for or connects to the ids of the old daemon until the next owner has made a new sink
+  * @warning Call with the thread loop locked */
+static void shared_sink_forget(struct obs_pw_audio_capture_app *pwac)
+{
+	pthread_mutex_lock(&shared_sinks_mutex);
+
+	struct shared_capture_sink *group = pwac->shared.group;
+	if (group) {
+		group->ready = false;
+		group->linked = false;
+		group->id = SPA_ID_INVALID;
+		group->serial = SPA_ID_INVALID;
+	}
+
+	pthread_mutex_unlock(&shared_sinks_mutex);
+}
+
+/** Act on this source's role in its group.
+  * The owner creates its sink if it's missing, followers (re)connect to the published sink
+  * @warning Call with the thread loop locked */
+static void shared_sink_sync(struct obs_pw_audio_capture_app *pwac)
+{
+	pthread_mutex_lock(&shared_sinks_mutex);
+
+	struct shared_capture_sink *group = pwac->shared.group;
+	if (!group) {
+		pthread_mutex_unlock(&shared_sinks_mutex);
+		return;
+	}
+
+	/* Any change made after this is signaled again */
+	bool is_owner = group->owner == pwac;
+	bool ready = group->ready;
+	uint32_t id = group->id;
+	uint32_t serial = group->serial;
+	uint32_t channels = group->channels;
+
+	pthread_mutex_unlock(&shared_sinks_mutex);
+
+	if (is_owner) {
+		/* Promoted from follower, the stream stays on the previous owner's sink until this one's is ready.
+		 * See finalize_capture_sink */
+		if (!pwac->sink.proxy && pwac->default_sink.channels) {
+			make_capture_sink(pwac, pwac->default_sink.channels, pwac->default_sink.position.array);
+		}
+
+		return;
+	}
+
+	bool stream_is_unconnected = pw_stream_get_state(pwac->pw.audio.stream, NULL) == PW_STREAM_STATE_UNCONNECTED;
+
+	if (ready && !stream_is_unconnected && pwac->shared.connected_serial == serial) {
+		/* Already streaming from the shared sink */
+		return;
+	}
+
+	if (!stream_is_unconnected) {
+		pw_stream_disconnect(pwac->pw.audio.stream);
+	}
+	pwac->shared.connected_serial = SPA_ID_INVALID;
+
+	if (!ready) {
+		return;
+	}
+
+	if (obs_pw_audio_stream_connect(&pwac->pw.audio, id, serial, channels) < 0) {
+		blog(LOG_WARNING, "[pipewire-audio] Error connecting stream %p to shared app capture sink %u",
+		     pwac->pw.audio.stream, id);
+	} else {
+		pwac->shared.connected_serial = serial;
+		blog(LOG_DEBUG, "[pipewire-audio] Stream %p sharing app capture sink %u", pwac->pw.audio.stream, id);
+	}
+}
+
+static void on_shared_sink_event_cb(void *data, uint64_t count)
+{
+	UNUSED_PARAMETER(count);
+	shared_sink_sync(data);
+}
+
+static struct shared_capture_sink *find_shared_sink_locked(const char *key)
+{
+	for (size_t i = 0; i < shared_sinks.num; i++) {
+		if (strcmp(shared_sinks.array[i]->key, key) == 0) {
+			return shared_sinks.array[i];
+		}
+	}
+
+	return NULL;
+}
+
+/** Join the group of sources with selections equivalent to this source's,
+  * creating it if there is none
+  * @warning Call with the thread loop locked */
+static void shared_sink_join(struct obs_pw_audio_capture_app *pwac)
+{
+	struct dstr key;
+	dstr_init(&key);
+	build_selections_key(pwac, &key);
+
+	pthread_mutex_lock(&shared_sinks_mutex);
+
+	struct shared_capture_sink *current = pwac->shared.group;
+	bool unchanged = current && strcmp(current->key, key.array) == 0;
+
+	/* Nobody else uses the sink, just relink it */
+	bool relink = !unchanged && current && current->owner == pwac && current->followers.num == 0 &&
+		      !find_shared_sink_locked(key.array);
+	if (relink) {
+		bfree(current->key);
+		current->key = bstrdup(key.array);
+	}
+
+	pthread_mutex_unlock(&shared_sinks_mutex);
+
+	if (unchanged || relink) {
+		if (relink) {
+			connect_targets(pwac);
+		}
+
+		dstr_free(&key);
+		return;
+	}
+
+	shared_sink_leave(pwac);
+
+	pthread_mutex_lock(&shared_sinks_mutex);
+
+	struct shared_capture_sink *group = find_shared_sink_locked(key.array);
+	if (group) {
+		da_push_back(group->followers, &pwac);
+	} else {
+		group = bzalloc(sizeof(struct shared_capture_sink));
+		group->key = bstrdup(key.array);
+		group->owner = pwac;
+		da_push_back(shared_sinks, &group);
+	}
+
+	pwac->shared.group = group;
+
+	pthread_mutex_unlock(&shared_sinks_mutex);
+
+	dstr_free(&key);
+
+	shared_sink_sync(pwac);
+}
+
+/** Remember the layout of the app capture sink and
+  * recreate the sink with it if this source owns one */
+static void set_capture_sink_layout(struct obs_pw_audio_capture_app *pwac, uint32_t channels, const char *position)
+{
+	if (channels == pwac->default_sink.channels && dstr_cmpi(&pwac->default_sink.position, position) == 0) {
+		return;
+	}
+
+	pwac->default_sink.channels = channels;
+	dstr_copy(&pwac->default_sink.position, position);
+
+	if (!shared_sink_is_owner(pwac)) {
+		return;
 	}
+
+	destroy_capture_sink(pwac);
+	make_capture_sink(pwac, channels, position);
 }
+
 /* ------------------------------------------------- */
 
-/* App capture sink */
+/* Direct capture */
 
-/** The app capture sink is created when there
-  * is info about the system's default sink.
-  * See the on_metadata and on_default_sink callbacks */
-static void destroy_sink_links(struct obs_pw_audio_capture_app *pwac)
+/** Only a single, included app can be captured without the app capture sink,
+  * excluding apps or capturing several of them needs the sink to mix them */
+static bool can_capture_directly(struct obs_pw_audio_capture_app *pwac)
 {
-	obs_pw_audio_proxy_list_clear(&pwac->sink.links);
+	return pwac->capture_mode == CAPTURE_MODE_SINGLE && !pwac->except && pwac->selections.num == 1;
 }
 
-static void connect_targets(struct obs_pw_audio_capture_app *pwac)
+static void set_stream_capture_sink(struct obs_pw_audio_capture_app *pwac, bool capture_sink)
 {
-	if (!pwac->sink.proxy) {
+	if (pwac->direct.stream_capture_sink == capture_sink) {
 		return;
 	}
+	pwac->direct.stream_capture_sink = capture_sink;
 
-	destroy_sink_links(pwac);
+	const struct spa_dict_item items[] = {
+		SPA_DICT_ITEM_INIT(PW_KEY_STREAM_CAPTURE_SINK, capture_sink ? "true" : "false"),
+	};
+	pw_stream_update_properties(pwac->pw.audio.stream, &SPA_DICT_INIT_ARRAY(items));
+}
 
-	if (pwac->selections.num == 0) {
+static void disconnect_direct(struct obs_pw_audio_capture_app *pwac)
+{
+	if (pwac->direct.connected_serial == SPA_ID_INVALID) {
 		return;
 	}
 
-	struct obs_pw_audio_proxy_list_iter iter;
-	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->nodes);
-
-	struct target_node *node;
-	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&node)) {
-		if (node_is_targeted(pwac, node)) {
-			link_node_to_sink(pwac, node);
-		}
+	if (pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+		pw_stream_disconnect(pwac->pw.audio.stream);
 	}
+	pwac->direct.connected_serial = SPA_ID_INVALID;
 }
 
-static void finalize_capture_sink(struct obs_pw_audio_capture_app *pwac)
+static void connect_direct(struct obs_pw_audio_capture_app *pwac, struct target_node *node)
 {
-	if (!pwac->sink.proxy || pwac->sink.id == SPA_ID_INVALID || pwac->sink.serial == SPA_ID_INVALID ||
-	    pwac->sink.ports.num != pwac->sink.channels) {
+	if (node->serial == pwac->direct.connected_serial &&
+	    pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+		/* Already connected to this node */
 		return;
 	}
 
-	blog(LOG_DEBUG, "[pipewire-audio] App capture sink ready");
-
-	connect_targets(pwac);
+	disconnect_direct(pwac);
 
-	pwac->sink.autoconnect_targets = true;
+	/* The app's format isn't known yet, let PipeWire convert to what OBS outputs */
+	struct obs_audio_info oai;
+	uint32_t channels = obs_get_audio_info(&oai) ? get_audio_channels(oai.speakers) : 2;
 
-	if (obs_pw_audio_stream_connect(&pwac->pw.audio, pwac->sink.id, pwac->sink.serial, pwac->sink.channels) < 0) {
-		blog(LOG_WARNING, "[pipewire-audio] Error connecting stream %p to app capture sink %u",
-		     pwac->pw.audio.stream, pwac->sink.id);
+	if (obs_pw_audio_stream_connect(&pwac->pw.audio, node->id, node->serial, channels) == 0) {
+		pwac->direct.connected_serial = node->serial;
+		blog(LOG_INFO, "[pipewire-audio] %p capturing app stream %u directly", pwac->pw.audio.stream,
+		     node->serial);
+	} else {
+		blog(LOG_WARNING, "[pipewire-audio] Error connecting stream %p to app stream %u",
+		     pwac->pw.audio.stream, node->serial);
 	}
 }
 
-static void on_sink_proxy_bound_cb(void *data, uint32_t global_id)
-{
-	struct obs_pw_audio_capture_app *pwac = data;
-	pwac->sink.id = global_id;
-	da_init(pwac->sink.ports);
-}
-
-static void on_sink_proxy_removed_cb(void *data)
-{
-	struct obs_pw_audio_capture_app *pwac = data;
-	blog(LOG_WARNING, "[pipewire-audio] App capture sink %u has been destroyed by the PipeWire remote",
-	     pwac->sink.id);
-	pw_proxy_destroy(pwac->sink.proxy);
-}
-
-static void on_sink_proxy_destroy_cb(void *data)
+/* Called by the stream's watchdog when it failed or stopped receiving buffers */
+static void on_stream_stalled_cb(void *data)
 {
 	struct obs_pw_audio_capture_app *pwac = data;
 
-	spa_hook_remove(&pwac->sink.proxy_listener);
-	spa_zero(pwac->sink.proxy_listener);
-
-	for (size_t i = 0; i < pwac->sink.ports.num; i++) {
-		struct capture_sink_port *p = &pwac->sink.ports.array[i];
-		bfree((void *)p->channel);
+	if (pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+		pw_stream_disconnect(pwac->pw.audio.stream);
 	}
-	da_free(pwac->sink.ports);
-
-	pwac->sink.channels = 0;
-	dstr_free(&pwac->sink.position);
-
-	pwac->sink.autoconnect_targets = false;
-	pwac->sink.proxy = NULL;
-
-	blog(LOG_DEBUG, "[pipewire-audio] App capture sink %u destroyed", pwac->sink.id);
 
-	pwac->sink.id = SPA_ID_INVALID;
+	if (pwac->direct.connected_serial != SPA_ID_INVALID) {
+		pwac->direct.connected_serial = SPA_ID_INVALID;
+		update_capture_path(pwac);
+	} else if (shared_sink_is_owner(pwac)) {
+		finalize_capture_sink(pwac);
+	} else {
+		pwac->shared.connected_serial = SPA_ID_INVALID;
+		shared_sink_sync(pwac);
+	}
 }
 
-static void on_sink_proxy_error_cb(void *data, int seq, int res, const char *message)
+/** An app capture sink without links gets no buffers, that's not a stall */
+static bool is_stream_idle_cb(void *data)
 {
-	UNUSED_PARAMETER(data);
-	blog(LOG_ERROR, "[pipewire-audio] App capture sink error: seq:%d res:%d :%s", seq, res, message);
-}
-
-static const struct pw_proxy_events sink_proxy_events = {
-	PW_VERSION_PROXY_EVENTS,
-	.bound = on_sink_proxy_bound_cb,
-	.removed = on_sink_proxy_removed_cb,
-	.destroy = on_sink_proxy_destroy_cb,
-	.error = on_sink_proxy_error_cb,
-};
+	struct obs_pw_audio_capture_app *pwac = data;
 
-static void register_capture_sink_port(struct obs_pw_audio_capture_app *pwac, uint32_t global_id, const char *channel)
-{
-	blog(LOG_DEBUG, "[pipewire-audio] Registering app capture sink port %u", global_id);
+	if (pwac->direct.connected_serial != SPA_ID_INVALID) {
+		return false;
+	}
 
-	struct capture_sink_port *port = da_push_back_new(pwac->sink.ports);
-	port->channel = bstrdup(channel);
-	port->id = global_id;
+	pthread_mutex_lock(&shared_sinks_mutex);
+	bool idle = pwac->shared.group && !pwac->shared.group->linked;
+	pthread_mutex_unlock(&shared_sinks_mutex);
 
-	finalize_capture_sink(pwac);
+	return idle;
 }
 
-static void make_capture_sink(struct obs_pw_audio_capture_app *pwac, uint32_t channels, const char *position)
+/** Pick between capturing the targeted app stream directly or through the app capture sink.
+  * Falls back to the sink while more than one stream matches, so none of them are dropped
+  * @warning Call with the thread loop locked */
+static void update_capture_path(struct obs_pw_audio_capture_app *pwac)
 {
-	struct pw_properties *sink_props = pw_properties_new(PW_KEY_FACTORY_NAME, "support.null-audio-sink",
-							     PW_KEY_MEDIA_CLASS, "Stream/Input/Audio",
-							     PW_KEY_NODE_VIRTUAL, "true", SPA_KEY_AUDIO_POSITION,
-							     position, NULL);
-
-	pw_properties_setf(sink_props, PW_KEY_NODE_NAME, "OBS: %s", obs_source_get_name(pwac->source));
-
-	pw_properties_setf(sink_props, PW_KEY_AUDIO_CHANNELS, "%u", channels);
-
-	pwac->sink.proxy = pw_core_create_object(pwac->pw.core, "adapter", PW_TYPE_INTERFACE_Node, PW_VERSION_NODE,
-						 &sink_props->dict, 0);
-
-	pw_properties_free(sink_props);
-
-	if (!pwac->sink.proxy) {
-		blog(LOG_WARNING, "[pipewire-audio] Failed to create app capture sink");
+	if (!pwac->pw.core) {
+		/* Reconnecting failed halfway, the path is rebuilt once it succeeds */
 		return;
 	}
 
-	pwac->sink.channels = channels;
-	dstr_copy(&pwac->sink.position, position);
+	pwac->direct.enabled = can_capture_directly(pwac);
 
-	pwac->sink.id = SPA_ID_INVALID;
-	pwac->sink.serial = SPA_ID_INVALID;
+	struct target_node *target = NULL;
+	size_t n_targeted = 0;
 
-	pw_proxy_add_listener(pwac->sink.proxy, &pwac->sink.proxy_listener, &sink_proxy_events, pwac);
+	if (pwac->direct.enabled) {
+		struct obs_pw_audio_proxy_list_iter iter;
+		obs_pw_audio_proxy_list_iter_init(&iter, &pwac->nodes);
 
-	blog(LOG_DEBUG, "[pipewire-audio] Created app capture sink");
-}
+		struct target_node *node;
+		while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&node)) {
+			if (node_is_targeted(pwac, node)) {
+				target = node;
+				n_targeted++;
+			}
+		}
+	}
 
-static void destroy_capture_sink(struct obs_pw_audio_capture_app *pwac)
-{
-	/* Links are automatically destroyed by PipeWire */
+	if (!pwac->direct.enabled || n_targeted > 1 || (target && target->serial == SPA_ID_INVALID)) {
+		disconnect_direct(pwac);
+		set_stream_capture_sink(pwac, true);
 
-	if (!pwac->sink.proxy) {
+		shared_sink_join(pwac);
 		return;
 	}
 
-	if (pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
-		pw_stream_disconnect(pwac->pw.audio.stream);
+	if (pwac->shared.group) {
+		shared_sink_leave(pwac);
 	}
+	set_stream_capture_sink(pwac, false);
 
-	pwac->sink.autoconnect_targets = false;
-	pw_proxy_destroy(pwac->sink.proxy);
+	if (target) {
+		connect_direct(pwac, target);
+	} else {
+		disconnect_direct(pwac);
+	}
 }
 /* ------------------------------------------------- */
 
@@ -558,12 +1495,12 @@ static void on_default_sink_param_cb(void *data, int seq, uint32_t id, uint32_t
 	UNUSED_PARAMETER(index);
 	UNUSED_PARAMETER(next);
 
-	if (id != SPA_PARAM_EnumFormat) {
+	struct obs_pw_audio_capture_app *pwac = data;
+
+	if (id != SPA_PARAM_EnumFormat || pwac->default_sink.layout_fixed) {
 		return;
 	}
 
-	struct obs_pw_audio_capture_app *pwac = data;
-
 	uint32_t media_type = 0, media_subtype = 0, parsed_id = 0, channels = 0;
 	struct spa_pod *position_pod = NULL;
 
@@ -575,7 +1512,7 @@ static void on_default_sink_param_cb(void *data, int seq, uint32_t id, uint32_t
 				  SPA_POD_OPT_Int(&channels), SPA_FORMAT_AUDIO_position,
 				  SPA_POD_OPT_Pod(&position_pod));
 
-	if (pwac->sink.channels && !channels) {
+	if (pwac->default_sink.channels && !channels) {
 		// It's likely we got the channels from a proper format already
 		return;
 	}
@@ -608,23 +1545,21 @@ static void on_default_sink_param_cb(void *data, int seq, uint32_t id, uint32_t
 		}
 	}
 
-	if (channels != pwac->sink.channels || dstr_cmpi(&position_str, pwac->sink.position.array) != 0) {
-		destroy_capture_sink(pwac);
-		make_capture_sink(pwac, channels, position_str.array);
-	}
+	pwac->default_sink.layout_fixed = true;
+
+	set_capture_sink_layout(pwac, channels, position_str.array);
 
 	dstr_free(&position_str);
 	return;
 
 stereo_fallback:
-	if (pwac->sink.proxy) {
+	if (pwac->default_sink.channels) {
 		return;
 	}
 
 	blog(LOG_WARNING, "[pipewire-audio] Could not parse format of default sink. Falling back to stereo.");
 
-	destroy_capture_sink(pwac);
-	make_capture_sink(pwac, 2, "[FL,FR]");
+	set_capture_sink_layout(pwac, 2, "[FL,FR]");
 }
 
 static const struct pw_node_events default_sink_events = {
@@ -656,12 +1591,8 @@ static const struct pw_proxy_events default_sink_proxy_events = {
 	.destroy = on_default_sink_proxy_destroy_cb,
 };
 
-static void default_node_cb(void *data, const char *name)
+static void bind_default_sink(struct obs_pw_audio_capture_app *pwac, const char *name)
 {
-	struct obs_pw_audio_capture_app *pwac = data;
-
-	blog(LOG_DEBUG, "[pipewire-audio] New default sink %s", name);
-
 	/* Find the new default sink and bind to it to get its channel info */
 	struct obs_pw_audio_proxy_list_iter iter;
 	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->system_sinks);
@@ -684,10 +1615,10 @@ static void default_node_cb(void *data, const char *name)
 	pwac->default_sink.proxy =
 		pw_registry_bind(pwac->pw.registry, default_sink->id, PW_TYPE_INTERFACE_Node, PW_VERSION_NODE, 0);
 	if (!pwac->default_sink.proxy) {
-		if (!pwac->sink.proxy) {
+		if (!pwac->default_sink.channels) {
 			blog(LOG_WARNING,
 			     "[pipewire-audio] Failed to get default sink info, app capture sink defaulting to stereo");
-			make_capture_sink(pwac, 2, "FL,FR");
+			set_capture_sink_layout(pwac, 2, "FL,FR");
 		}
 		return;
 	}
@@ -699,15 +1630,76 @@ static void default_node_cb(void *data, const char *name)
 
 	pw_node_subscribe_params((struct pw_node *)pwac->default_sink.proxy, (uint32_t[]){SPA_PARAM_EnumFormat}, 1);
 }
+
+static void default_node_cb(void *data, const char *name)
+{
+	struct obs_pw_audio_capture_app *pwac = data;
+
+	blog(LOG_DEBUG, "[pipewire-audio] New default sink %s", name);
+
+	dstr_copy(&pwac->default_sink.name, name);
+
+	if (pwac->default_sink.layout_fixed) {
+		/* Output device switches don't affect the app capture sink */
+		return;
+	}
+
+	bind_default_sink(pwac, name);
+}
 /* ------------------------------------------------- */
 
-/* Registry */
-static void on_global_cb(void *data, uint32_t id, uint32_t permissions, const char *type, uint32_t version,
-			 const struct spa_dict *props)
+/* App capture sink layout */
+static void get_obs_output_layout(uint32_t *channels, struct dstr *position)
 {
-	UNUSED_PARAMETER(permissions);
-	UNUSED_PARAMETER(version);
+	struct obs_audio_info oai;
+	*channels = obs_get_audio_info(&oai) ? get_audio_channels(oai.speakers) : 2;
+
+	enum spa_audio_channel pos[8];
+	obs_channels_to_spa_audio_position(pos, *channels);
+
+	dstr_free(position);
+	for (size_t i = 0; i < *channels; i++) {
+		if (i != 0) {
+			dstr_cat_ch(position, ',');
+		}
+		dstr_cat(position, spa_debug_type_find_short_name(spa_type_audio_channel, pos[i]));
+	}
+}
+
+/** Size the app capture sink as configured. Matching OBS's speaker layout
+  * avoids having PipeWire remix every app to the default sink's layout
+  * just for OBS to remix it again
+  * @warning Call with the thread loop locked */
+static void apply_sink_layout(struct obs_pw_audio_capture_app *pwac)
+{
+	switch (pwac->sink_layout) {
+	case SINK_LAYOUT_OBS_OUTPUT: {
+		pwac->default_sink.layout_fixed = true;
+
+		uint32_t channels;
+		struct dstr position;
+		dstr_init(&position);
+
+		get_obs_output_layout(&channels, &position);
+		set_capture_sink_layout(pwac, channels, position.array);
+
+		dstr_free(&position);
+		break;
+	}
+	case SINK_LAYOUT_DEFAULT_SINK:
+		pwac->default_sink.layout_fixed = false;
 
+		if (!dstr_is_empty(&pwac->default_sink.name)) {
+			bind_default_sink(pwac, pwac->default_sink.name.array);
+		}
+		break;
+	}
+}
+/* ------------------------------------------------- */
+
+/* Registry */
+static void handle_global(void *data, uint32_t id, const char *type, const struct spa_dict *props)
+{
 	if (!props || !type) {
 		return;
 	}
@@ -756,7 +1748,7 @@ static void on_global_cb(void *data, uint32_t id, uint32_t permissions, const ch
 			struct target_node_port *port = node_register_port(node, id, pwac->pw.registry, chn);
 
 			if (port && pwac->sink.autoconnect_targets && node_is_targeted(pwac, node)) {
-				link_port_to_sink(pwac, port, node->id);
+				link_port_to_sink(pwac, port, node);
 			}
 		}
 	} else if (strcmp(type, PW_TYPE_INTERFACE_Node) == 0) {
@@ -779,7 +1771,13 @@ static void on_global_cb(void *data, uint32_t id, uint32_t permissions, const ch
 				client_id = strtoul(client_id_str, NULL, 10);
 			}
 
-			register_target_node(pwac, id, client_id, node_app_name, node_name);
+			uint32_t object_serial = SPA_ID_INVALID;
+			const char *ser = spa_dict_lookup(props, PW_KEY_OBJECT_SERIAL);
+			if (ser) {
+				object_serial = strtoul(ser, NULL, 10);
+			}
+
+			register_target_node(pwac, id, object_serial, client_id, node_app_name, node_name);
 		} else if (strcmp(media_class, "Audio/Sink") == 0) {
 			register_system_sink(pwac, id, node_name);
 		}
@@ -795,14 +1793,25 @@ static void on_global_cb(void *data, uint32_t id, uint32_t permissions, const ch
 
 		if (!obs_pw_audio_default_node_metadata_listen(&pwac->default_sink.metadata, &pwac->pw, id, true,
 							       default_node_cb, pwac) &&
-		    !pwac->sink.proxy) {
+		    !pwac->default_sink.channels) {
 			blog(LOG_WARNING,
 			     "[pipewire-audio] Failed to get default metadata, app capture sink defaulting to stereo");
-			make_capture_sink(pwac, 2, "FL,FR");
+			set_capture_sink_layout(pwac, 2, "FL,FR");
 		}
 	}
 }
 
+static void on_global_cb(void *data, uint32_t id, uint32_t permissions, const char *type, uint32_t version,
+			 const struct spa_dict *props)
+{
+	UNUSED_PARAMETER(permissions);
+	UNUSED_PARAMETER(version);
+
+	profile_start(profile_global);
+	handle_global(data, id, type, props);
+	profile_end(profile_global);
+}
+
 static const struct pw_registry_events registry_events = {
 	PW_VERSION_REGISTRY_EVENTS,
 	.global = on_global_cb,
@@ -878,34 +1887,46 @@ static const char *choose_display_string(struct obs_pw_audio_capture_app *pwac,
 	}
 }
 
-static void populate_avaiable_apps_list(obs_property_t *list, struct obs_pw_audio_capture_app *pwac)
+static void rebuild_targets_snapshot(void *data, struct obs_pw_audio_target_snapshot *snapshot)
 {
-	DARRAY(const char *) targets;
-	da_init(targets);
-
-	pw_thread_loop_lock(pwac->pw.thread_loop);
-
-	da_reserve(targets, pwac->n_nodes);
+	struct obs_pw_audio_capture_app *pwac = data;
 
 	struct obs_pw_audio_proxy_list_iter iter;
 	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->nodes);
 
 	struct target_node *node;
 	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&node)) {
-		const char *display = choose_display_string(pwac, node->binary, node->app_name);
-
-		if (!display) {
-			display = node->name;
-		}
-
-		da_push_back(targets, &display);
+		obs_pw_audio_target_snapshot_add(snapshot, node->serial, node->name, node->app_name, node->binary);
 	}
 
 	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->clients);
 
 	struct target_client *client;
 	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&client)) {
-		const char *display = choose_display_string(pwac, client->binary, client->app_name);
+		obs_pw_audio_target_snapshot_add(snapshot, SPA_ID_INVALID, NULL, client->app_name, client->binary);
+	}
+
+	count_links(pwac, &snapshot->active_links, &snapshot->failed_links);
+}
+
+static void populate_avaiable_apps_list(obs_property_t *list, struct obs_pw_audio_capture_app *pwac)
+{
+	DARRAY(const char *) targets;
+	da_init(targets);
+
+	struct obs_pw_audio_target_snapshot *snapshot = obs_pw_audio_target_publisher_get(&pwac->targets_snapshot);
+
+	da_reserve(targets, snapshot->targets.num);
+
+	for (size_t i = 0; i < snapshot->targets.num; i++) {
+		struct obs_pw_audio_target *target = &snapshot->targets.array[i];
+
+		const char *display = choose_display_string(pwac, target->binary, target->app_name);
+
+		if (!display) {
+			/* Only nodes have a name */
+			display = target->name;
+		}
 
 		if (display) {
 			da_push_back(targets, &display);
@@ -922,7 +1943,7 @@ static void populate_avaiable_apps_list(obs_property_t *list, struct obs_pw_audi
 		}
 	}
 
-	pw_thread_loop_unlock(pwac->pw.thread_loop);
+	obs_pw_audio_target_snapshot_release(snapshot);
 
 	da_free(targets);
 }
@@ -1038,6 +2059,49 @@ static void clear_selections(struct obs_pw_audio_capture_app *pwac)
 	pwac->selections.num = 0;
 }
 
+/* PipeWire restarts */
+static void on_core_lost_cb(void *data)
+{
+	struct obs_pw_audio_capture_app *pwac = data;
+
+	/* Keep the nodes going away from retargeting the stream, the capture path is rebuilt once reconnected */
+	pwac->direct.enabled = false;
+	disconnect_direct(pwac);
+	shared_sink_forget(pwac);
+	shared_sink_leave(pwac);
+
+	obs_pw_audio_proxy_list_clear(&pwac->nodes);
+	obs_pw_audio_proxy_list_clear(&pwac->system_sinks);
+	obs_pw_audio_proxy_list_clear(&pwac->clients);
+
+	if (pwac->default_sink.proxy) {
+		pw_proxy_destroy(pwac->default_sink.proxy);
+	}
+	if (pwac->default_sink.metadata.proxy) {
+		pw_proxy_destroy(pwac->default_sink.metadata.proxy);
+	}
+
+	remove_all_links(pwac);
+
+	spa_hook_remove(&pwac->core_listener);
+	spa_zero(pwac->core_listener);
+
+	/* The stream is recreated as a capture sink stream */
+	pwac->direct.stream_capture_sink = true;
+}
+
+static void on_core_restored_cb(void *data)
+{
+	struct obs_pw_audio_capture_app *pwac = data;
+
+	pw_core_add_listener(pwac->pw.core, &pwac->core_listener, &core_events, pwac);
+	pwac->sink.pending_links_seq = 0;
+
+	/* Recreates the app capture sink with the known layout, targets are linked as the registry announces them */
+	update_capture_path(pwac);
+}
+/* ------------------------------------------------- */
+
 static void *pipewire_audio_capture_app_create(obs_data_t *settings, obs_source_t *source)
 {
 	struct obs_pw_audio_capture_app *pwac = bzalloc(sizeof(struct obs_pw_audio_capture_app));
@@ -1051,21 +2115,47 @@ static void *pipewire_audio_capture_app_create(obs_data_t *settings, obs_source_
 
 	pwac->source = source;
 
+	pw_core_add_listener(pwac->pw.core, &pwac->core_listener, &core_events, pwac);
+
 	obs_pw_audio_proxy_list_init(&pwac->nodes, NULL, node_destroy_cb);
 	obs_pw_audio_proxy_list_init(&pwac->clients, NULL, client_destroy_cb);
-	obs_pw_audio_proxy_list_init(&pwac->sink.links, link_bound_cb, link_destroy_cb);
 	obs_pw_audio_proxy_list_init(&pwac->system_sinks, NULL, system_sink_destroy_cb);
+	obs_pw_audio_target_publisher_init(&pwac->targets_snapshot, pw_thread_loop_get_loop(pwac->pw.thread_loop),
+					   rebuild_targets_snapshot, pwac);
 
 	pwac->sink.id = SPA_ID_INVALID;
-	dstr_init(&pwac->sink.position);
+	da_init(pwac->sink.links);
+	pwac->sink.retry_timer =
+		pw_loop_add_timer(pw_thread_loop_get_loop(pwac->pw.thread_loop), on_link_retry_timer_cb, pwac);
+	dstr_init(&pwac->default_sink.name);
+	dstr_init(&pwac->default_sink.position);
+
+	pwac->shared.connected_serial = SPA_ID_INVALID;
+	pwac->direct.connected_serial = SPA_ID_INVALID;
+	pwac->direct.stream_capture_sink = true;
+	pwac->shared.event =
+		pw_loop_add_event(pw_thread_loop_get_loop(pwac->pw.thread_loop), on_shared_sink_event_cb, pwac);
+
+	obs_pw_audio_stream_set_watchdog(&pwac->pw.audio, on_stream_stalled_cb, is_stream_idle_cb, pwac);
+	obs_pw_audio_instance_set_reconnect_callbacks(&pwac->pw, on_core_lost_cb, on_core_restored_cb);
 
 	pwac->capture_mode = obs_data_get_int(settings, SETTING_CAPTURE_MODE);
 	pwac->match_priority = obs_data_get_int(settings, SETTING_MATCH_PRIORITY);
 	pwac->except = obs_data_get_bool(settings, SETTING_EXCLUDE_SELECTIONS);
+	pwac->sink_layout = obs_data_get_int(settings, SETTING_SINK_LAYOUT);
+
+	apply_sink_layout(pwac);
+
+	obs_pw_audio_stream_set_packet_latency(&pwac->pw.audio, obs_data_get_int(settings, SETTING_PACKET_LATENCY));
+	obs_pw_audio_stream_set_lock_memory(&pwac->pw.audio, obs_data_get_bool(settings, SETTING_LOCK_MEMORY));
+	obs_pw_audio_stream_set_latency_compensation(&pwac->pw.audio,
+						     obs_data_get_bool(settings, SETTING_COMPENSATE_LATENCY));
 
 	da_init(pwac->selections);
 	build_selections(pwac, settings);
 
+	update_capture_path(pwac);
+
 	pw_thread_loop_unlock(pwac->pw.thread_loop);
 
 	return pwac;
@@ -1076,6 +2166,10 @@ static void pipewire_audio_capture_app_defaults(obs_data_t *settings)
 	obs_data_set_default_int(settings, SETTING_CAPTURE_MODE, CAPTURE_MODE_SINGLE);
 	obs_data_set_default_int(settings, SETTING_MATCH_PRIORITY, MATCH_PRIORITY_BINARY_NAME);
 	obs_data_set_default_bool(settings, SETTING_EXCLUDE_SELECTIONS, false);
+	obs_data_set_default_int(settings, SETTING_SINK_LAYOUT, SINK_LAYOUT_OBS_OUTPUT);
+	obs_data_set_default_int(settings, SETTING_PACKET_LATENCY, 0);
+	obs_data_set_default_bool(settings, SETTING_LOCK_MEMORY, false);
+	obs_data_set_default_bool(settings, SETTING_COMPENSATE_LATENCY, false);
 
 	obs_data_array_t *arr = obs_data_array_create();
 	obs_data_set_default_array(settings, SETTING_SELECTION_MULTIPLE, arr);
@@ -1102,6 +2196,39 @@ static obs_properties_t *pipewire_audio_capture_app_properties(void *data)
 
 	obs_properties_add_bool(p, SETTING_EXCLUDE_SELECTIONS, obs_module_text("ExceptApp"));
 
+	if (pwac) {
+		obs_pw_audio_stream_add_stats(&pwac->pw.audio, p);
+
+		struct obs_pw_audio_target_snapshot *snapshot =
+			obs_pw_audio_target_publisher_get(&pwac->targets_snapshot);
+
+		struct dstr link_stats;
+		dstr_init(&link_stats);
+		dstr_printf(&link_stats, "%s: %zu, %s: %zu", obs_module_text("ActiveLinks"), snapshot->active_links,
+			    obs_module_text("FailedLinks"), snapshot->failed_links);
+		obs_properties_add_text(p, "LinkStats", link_stats.array, OBS_TEXT_INFO);
+		dstr_free(&link_stats);
+
+		obs_pw_audio_target_snapshot_release(snapshot);
+	}
+
+	obs_property_t *sink_layout = obs_properties_add_list(
+		p, SETTING_SINK_LAYOUT, obs_module_text("SinkLayout"), OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(sink_layout, obs_module_text("SinkLayoutOBS"), SINK_LAYOUT_OBS_OUTPUT);
+	obs_property_list_add_int(sink_layout, obs_module_text("SinkLayoutDefaultSink"), SINK_LAYOUT_DEFAULT_SINK);
+
+	obs_property_t *packet_latency = obs_properties_add_int_slider(p, SETTING_PACKET_LATENCY,
+								       obs_module_text("PacketLatency"), 0, 50, 1);
+	obs_property_int_set_suffix(packet_latency, " ms");
+	obs_property_set_long_description(packet_latency, obs_module_text("PacketLatencyDescription"));
+
+	obs_property_t *lock_memory = obs_properties_add_bool(p, SETTING_LOCK_MEMORY, obs_module_text("LockMemory"));
+	obs_property_set_long_description(lock_memory, obs_module_text("LockMemoryDescription"));
+
+	obs_property_t *compensate_latency = obs_properties_add_bool(p, SETTING_COMPENSATE_LATENCY,
+								     obs_module_text("CompensateLatency"));
+	obs_property_set_long_description(compensate_latency, obs_module_text("CompensateLatencyDescription"));
+
 	return p;
 }
 
@@ -1115,10 +2242,21 @@ static void pipewire_audio_capture_app_update(void *data, obs_data_t *settings)
 	pwac->match_priority = obs_data_get_int(settings, SETTING_MATCH_PRIORITY);
 	pwac->except = obs_data_get_bool(settings, SETTING_EXCLUDE_SELECTIONS);
 
+	enum sink_layout sink_layout = obs_data_get_int(settings, SETTING_SINK_LAYOUT);
+	if (sink_layout != pwac->sink_layout) {
+		pwac->sink_layout = sink_layout;
+		apply_sink_layout(pwac);
+	}
+
+	obs_pw_audio_stream_set_packet_latency(&pwac->pw.audio, obs_data_get_int(settings, SETTING_PACKET_LATENCY));
+	obs_pw_audio_stream_set_lock_memory(&pwac->pw.audio, obs_data_get_bool(settings, SETTING_LOCK_MEMORY));
+	obs_pw_audio_stream_set_latency_compensation(&pwac->pw.audio,
+						     obs_data_get_bool(settings, SETTING_COMPENSATE_LATENCY));
+
 	clear_selections(pwac);
 	build_selections(pwac, settings);
 
-	connect_targets(pwac);
+	update_capture_path(pwac);
 
 	pw_thread_loop_unlock(pwac->pw.thread_loop);
 }
@@ -1128,7 +2266,7 @@ static void pipewire_audio_capture_app_show(void *data)
 	struct obs_pw_audio_capture_app *pwac = data;
 
 	pw_thread_loop_lock(pwac->pw.thread_loop);
-	pw_stream_set_active(pwac->pw.audio.stream, true);
+	obs_pw_audio_stream_set_active(&pwac->pw.audio, true);
 	pw_thread_loop_unlock(pwac->pw.thread_loop);
 }
 
@@ -1137,7 +2275,7 @@ static void pipewire_audio_capture_app_hide(void *data)
 	struct obs_pw_audio_capture_app *pwac = data;
 
 	pw_thread_loop_lock(pwac->pw.thread_loop);
-	pw_stream_set_active(pwac->pw.audio.stream, false);
+	obs_pw_audio_stream_set_active(&pwac->pw.audio, false);
 	pw_thread_loop_unlock(pwac->pw.thread_loop);
 }
 
@@ -1147,12 +2285,18 @@ static void pipewire_audio_capture_app_destroy(void *data)
 
 	pw_thread_loop_lock(pwac->pw.thread_loop);
 
+	pwac->direct.enabled = false;
+
 	obs_pw_audio_proxy_list_clear(&pwac->nodes);
 	obs_pw_audio_proxy_list_clear(&pwac->system_sinks);
 
 	obs_pw_audio_proxy_list_clear(&pwac->clients);
+	obs_pw_audio_target_publisher_destroy(&pwac->targets_snapshot);
 
-	destroy_capture_sink(pwac);
+	shared_sink_leave(pwac);
+
+	pw_loop_destroy_source(pw_thread_loop_get_loop(pwac->pw.thread_loop), pwac->shared.event);
+	pw_loop_destroy_source(pw_thread_loop_get_loop(pwac->pw.thread_loop), pwac->sink.retry_timer);
 
 	if (pwac->default_sink.proxy) {
 		pw_proxy_destroy(pwac->default_sink.proxy);
@@ -1161,9 +2305,13 @@ static void pipewire_audio_capture_app_destroy(void *data)
 		pw_proxy_destroy(pwac->default_sink.metadata.proxy);
 	}
 
+	spa_hook_remove(&pwac->core_listener);
+
 	obs_pw_audio_instance_destroy(&pwac->pw);
 
-	dstr_free(&pwac->sink.position);
+	da_free(pwac->sink.links);
+	dstr_free(&pwac->default_sink.name);
+	dstr_free(&pwac->default_sink.position);
 
 	clear_selections(pwac);
 	da_free(pwac->selections);
@@ -1179,6 +2327,14 @@ static const char *pipewire_audio_capture_app_name(void *data)
 
 void pipewire_audio_capture_app_load(void)
 {
+	pthread_mutex_init(&shared_sinks_mutex, NULL);
+	pthread_cond_init(&shared_sinks_cond, NULL);
+	da_init(shared_sinks);
+
+	profile_register_root(profile_global, 0);
+	profile_register_root(profile_finalize_capture_sink, 0);
+	profile_register_root(profile_connect_targets, 0);
+
 	const struct obs_source_info pipewire_audio_capture_application = {
 		.id = "pipewire_audio_application_capture",
 		.type = OBS_SOURCE_TYPE_INPUT,
@@ -31,6 +31,15 @@ struct target_node {
 	uint32_t id;
 	uint32_t channels;
 
+	/** Identifiers of the physical device. They aren't in the node's global, they come from
+	  * the node's info or its device's. The node isn't matched by anything but its name until then */
+	const char *bus_path;
+	const char *device_serial;
+	bool identified;
+	struct pw_proxy *device_proxy;
+	struct spa_hook device_listener;
+	struct spa_hook device_proxy_listener;
+
 	struct spa_hook node_listener;
 
 	struct obs_pw_audio_capture_device *pwac;
@@ -43,6 +52,26 @@ enum capture_type {
 
 #define SETTING_TARGET_SERIAL "TargetId"
 #define SETTING_TARGET_NAME "TargetName"
+#define SETTING_TARGET_CHANNELS "TargetChannels"
+#define SETTING_TARGET_BUS_PATH "TargetBusPath"
+#define SETTING_TARGET_DEVICE_SERIAL "TargetDeviceSerial"
+#define SETTING_TARGET_FRIENDLY_NAME "TargetFriendlyName"
+#define SETTING_PACKET_LATENCY "PacketLatency"
+#define SETTING_LOCK_MEMORY "LockMemory"
+#define SETTING_COMPENSATE_LATENCY "CompensateLatency"
+
+static const char *profile_global = OBS_PW_AUDIO_PROFILE_NAME("device registry global");
+static const char *profile_node_param = OBS_PW_AUDIO_PROFILE_NAME("device target node param");
+static const char *profile_start_streaming = OBS_PW_AUDIO_PROFILE_NAME("device start streaming");
+
+/** How a node was recognized as the saved target, from the weakest to the strongest identifier */
+enum target_match {
+	TARGET_MATCH_NONE,
+	TARGET_MATCH_FRIENDLY_NAME,
+	TARGET_MATCH_BUS_PATH,
+	TARGET_MATCH_DEVICE_SERIAL,
+	TARGET_MATCH_NAME,
+};
 
 struct obs_pw_audio_capture_device {
 	obs_source_t *source;
@@ -50,6 +79,12 @@ struct obs_pw_audio_capture_device {
 	enum capture_type capture_type;
 
 	struct obs_pw_audio_instance pw;
+	struct spa_hook core_listener;
+
+	/** Nodes only match the saved target by something else than its name once every node is known,
+	  * so that a node that still has the saved name is preferred */
+	int registry_seq;
+	bool registry_synced;
 
 	struct {
 		struct obs_pw_audio_default_node_metadata metadata;
@@ -59,64 +94,367 @@ struct obs_pw_audio_capture_device {
 	} default_info;
 
 	struct obs_pw_audio_proxy_list targets;
+	struct obs_pw_audio_target_publisher targets_snapshot;
 
+	/** Identity of the saved target. Names of Bluetooth and USB devices may change
+	  * when they reappear, the rest of the fields are used to recognize them */
 	struct dstr target_name;
+	struct dstr target_device_serial;
+	struct dstr target_bus_path;
+	struct dstr target_friendly_name;
+	uint32_t target_channels;
 	uint32_t connected_serial;
+	uint32_t connected_channels;
+
+	/** Switching targets connects this first and swaps it with the
+	  * instance's stream once it's producing audio */
+	struct {
+		struct obs_pw_audio_stream audio;
+		uint32_t serial;
+		uint32_t channels;
+		bool done;
+		struct spa_source *event;
+	} standby;
 };
 
+/** The properties show what's connected, keep their snapshot up to date */
+static void set_connected_serial(struct obs_pw_audio_capture_device *pwac, uint32_t serial)
+{
+	if (pwac->connected_serial != serial) {
+		pwac->connected_serial = serial;
+		obs_pw_audio_target_publisher_invalidate(&pwac->targets_snapshot);
+	}
+}
+
+static struct target_node *get_node_by_name(struct obs_pw_audio_capture_device *pwac, const char *name)
+{
+	struct obs_pw_audio_proxy_list_iter iter;
+	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->targets);
+
+	struct target_node *node;
+	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&node)) {
+		if (strcmp(node->name, name) == 0) {
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+static struct target_node *get_node_by_serial(struct obs_pw_audio_capture_device *pwac, uint32_t serial)
+{
+	struct obs_pw_audio_proxy_list_iter iter;
+	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->targets);
+
+	struct target_node *node;
+	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&node)) {
+		if (node->serial == serial) {
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+static void cancel_handover(struct obs_pw_audio_capture_device *pwac)
+{
+	if (pwac->standby.serial == SPA_ID_INVALID) {
+		return;
+	}
+
+	obs_pw_audio_stream_handover_cancel(&pwac->standby.audio, &pwac->pw.audio);
+
+	if (pw_stream_get_state(pwac->standby.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+		pw_stream_disconnect(pwac->standby.audio.stream);
+	}
+
+	pwac->standby.serial = SPA_ID_INVALID;
+	pwac->standby.done = false;
+}
+
+/* Called from the standby stream's process callback, the streams can't be swapped there */
+static void on_handover_done_cb(void *data)
+{
+	struct obs_pw_audio_capture_device *pwac = data;
+
+	pwac->standby.done = true;
+	pw_loop_signal_event(pw_thread_loop_get_loop(pwac->pw.thread_loop), pwac->standby.event);
+}
+
+static void on_handover_event_cb(void *data, uint64_t count)
+{
+	UNUSED_PARAMETER(count);
+
+	struct obs_pw_audio_capture_device *pwac = data;
+
+	if (!pwac->standby.done) {
+		/* Cancelled in the meantime */
+		return;
+	}
+
+	obs_pw_audio_stream_swap(&pwac->pw.audio, &pwac->standby.audio);
+
+	if (pw_stream_get_state(pwac->standby.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+		pw_stream_disconnect(pwac->standby.audio.stream);
+	}
+
+	set_connected_serial(pwac, pwac->standby.serial);
+	pwac->connected_channels = pwac->standby.channels;
+	pwac->standby.serial = SPA_ID_INVALID;
+	pwac->standby.done = false;
+
+	blog(LOG_INFO, "[pipewire-audio] %p streaming from %u", pwac->pw.audio.stream, pwac->connected_serial);
+}
+
+static void start_streaming(struct obs_pw_audio_capture_device *pwac, struct target_node *node);
+
+/* Called by the stream's watchdog when it failed or stopped receiving buffers */
+static void on_stream_stalled_cb(void *data)
+{
+	struct obs_pw_audio_capture_device *pwac = data;
+
+	/* Finish a pending switch instead of going back */
+	uint32_t serial = pwac->standby.serial != SPA_ID_INVALID ? pwac->standby.serial : pwac->connected_serial;
+
+	cancel_handover(pwac);
+
+	if (pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+		pw_stream_disconnect(pwac->pw.audio.stream);
+	}
+	set_connected_serial(pwac, SPA_ID_INVALID);
+
+	struct target_node *node = get_node_by_serial(pwac, serial);
+	if (node) {
+		start_streaming(pwac, node);
+	}
+}
+
 static void start_streaming(struct obs_pw_audio_capture_device *pwac, struct target_node *node)
 {
-	dstr_copy(&pwac->target_name, node->name);
+	profile_start(profile_start_streaming);
+
+	if (node->serial == pwac->standby.serial) {
+		/* Already switching to this node */
+		goto end;
+	}
+
+	cancel_handover(pwac);
 
 	if (pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
 		if (node->serial == pwac->connected_serial) {
 			/* Already connected to this node */
-			return;
+			goto end;
 		}
 
+		/* Keep the current stream going until the new one has negotiated and produces audio */
+		if (obs_pw_audio_stream_connect(&pwac->standby.audio, node->id, node->serial, node->channels) == 0) {
+			pwac->standby.serial = node->serial;
+			pwac->standby.channels = node->channels;
+			obs_pw_audio_stream_handover(&pwac->standby.audio, &pwac->pw.audio, on_handover_done_cb, pwac);
+			obs_pw_audio_stream_set_active(&pwac->standby.audio, obs_source_active(pwac->source));
+
+			blog(LOG_INFO, "[pipewire-audio] %p switching to %u", pwac->pw.audio.stream, node->serial);
+			goto end;
+		}
+
+		blog(LOG_WARNING, "[pipewire-audio] Error connecting standby stream %p, switching with a gap",
+		     pwac->standby.audio.stream);
+
 		pw_stream_disconnect(pwac->pw.audio.stream);
-		pwac->connected_serial = SPA_ID_INVALID;
+		set_connected_serial(pwac, SPA_ID_INVALID);
 	}
 
 	if (obs_pw_audio_stream_connect(&pwac->pw.audio, node->id, node->serial, node->channels) == 0) {
-		pwac->connected_serial = node->serial;
+		set_connected_serial(pwac, node->serial);
+		pwac->connected_channels = node->channels;
 		blog(LOG_INFO, "[pipewire-audio] %p streaming from %u", pwac->pw.audio.stream, node->serial);
 	} else {
-		pwac->connected_serial = SPA_ID_INVALID;
+		set_connected_serial(pwac, SPA_ID_INVALID);
 		blog(LOG_WARNING, "[pipewire-audio] Error connecting stream %p", pwac->pw.audio.stream);
 	}
 
-	pw_stream_set_active(pwac->pw.audio.stream, obs_source_active(pwac->source));
+	obs_pw_audio_stream_set_active(&pwac->pw.audio, obs_source_active(pwac->source));
+
+end:
+	profile_end(profile_start_streaming);
 }
 
-struct target_node *get_node_by_name(struct obs_pw_audio_capture_device *pwac, const char *name)
+/** Remember a node as the target to connect to in later sessions */
+static void set_target(struct obs_pw_audio_capture_device *pwac, struct target_node *node)
 {
-	struct obs_pw_audio_proxy_list_iter iter;
-	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->targets);
+	dstr_copy(&pwac->target_name, node->name);
+	dstr_copy(&pwac->target_device_serial, node->device_serial);
+	dstr_copy(&pwac->target_bus_path, node->bus_path);
+	dstr_copy(&pwac->target_friendly_name, node->friendly_name);
+	if (node->channels) {
+		pwac->target_channels = node->channels;
+	}
+}
 
-	struct target_node *node;
-	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&node)) {
-		if (strcmp(node->name, name) == 0) {
-			return node;
+static enum target_match match_target(struct obs_pw_audio_capture_device *pwac, struct target_node *n)
+{
+	if (!dstr_is_empty(&pwac->target_name) && dstr_cmp(&pwac->target_name, n->name) == 0) {
+		return TARGET_MATCH_NAME;
+	}
+
+	if (!n->identified) {
+		return TARGET_MATCH_NONE;
+	}
+
+	/* Same physical device under a different name */
+	if (!dstr_is_empty(&pwac->target_device_serial) && n->device_serial) {
+		return dstr_cmp(&pwac->target_device_serial, n->device_serial) == 0 ? TARGET_MATCH_DEVICE_SERIAL
+										    : TARGET_MATCH_NONE;
+	}
+
+	if (!dstr_is_empty(&pwac->target_bus_path) && n->bus_path) {
+		return dstr_cmp(&pwac->target_bus_path, n->bus_path) == 0 ? TARGET_MATCH_BUS_PATH : TARGET_MATCH_NONE;
+	}
+
+	/* Nothing better to go by */
+	if (dstr_is_empty(&pwac->target_bus_path) && !n->bus_path && !dstr_is_empty(&pwac->target_friendly_name) &&
+	    dstr_cmp(&pwac->target_friendly_name, n->friendly_name) == 0) {
+		return TARGET_MATCH_FRIENDLY_NAME;
+	}
+
+	return TARGET_MATCH_NONE;
+}
+
+/** How the node that's connected, or being switched to, matches the saved target */
+static enum target_match connected_match(struct obs_pw_audio_capture_device *pwac)
+{
+	uint32_t serial = pwac->standby.serial != SPA_ID_INVALID ? pwac->standby.serial : pwac->connected_serial;
+	struct target_node *node = get_node_by_serial(pwac, serial);
+
+	return node ? match_target(pwac, node) : TARGET_MATCH_NONE;
+}
+
+/** Connect to a node that matches the saved target better than what's connected.
+  * Only the exact name is trusted right away, other identifiers are a fallback once the registry
+  * is synced and no node has the saved name. A device serial is specific enough to remember the node's
+  * new name, weaker matches keep the saved identity so the original device is preferred when it's back */
+static void connect_target(struct obs_pw_audio_capture_device *pwac, struct target_node *n)
+{
+	enum target_match match = match_target(pwac, n);
+	if (match == TARGET_MATCH_NONE || match <= connected_match(pwac)) {
+		return;
+	}
+
+	if (match != TARGET_MATCH_NAME) {
+		if (!pwac->registry_synced ||
+		    (!dstr_is_empty(&pwac->target_name) && get_node_by_name(pwac, pwac->target_name.array))) {
+			return;
+		}
+
+		blog(LOG_INFO, "[pipewire-audio] Recognized node %u as the saved target %s", n->serial,
+		     pwac->target_name.array);
+
+		if (match >= TARGET_MATCH_DEVICE_SERIAL) {
+			set_target(pwac, n);
 		}
 	}
 
-	return NULL;
+	start_streaming(pwac, n);
 }
 
-struct target_node *get_node_by_serial(struct obs_pw_audio_capture_device *pwac, uint32_t serial)
+/** Connect the best fallback for the saved target among the known nodes */
+static void connect_best_target(struct obs_pw_audio_capture_device *pwac)
 {
+	if (pwac->default_info.autoconnect || !pwac->registry_synced) {
+		return;
+	}
+
+	struct target_node *best = NULL;
+	enum target_match best_match = TARGET_MATCH_NONE;
+
 	struct obs_pw_audio_proxy_list_iter iter;
 	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->targets);
 
 	struct target_node *node;
 	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&node)) {
-		if (node->serial == serial) {
-			return node;
+		enum target_match match = match_target(pwac, node);
+		if (match > best_match) {
+			best = node;
+			best_match = match;
 		}
 	}
 
-	return NULL;
+	if (best) {
+		connect_target(pwac, best);
+	}
+}
+
+/** Connect to a node that's the default or the saved target.
+  * This may happen before the node's formats are known, with channels from its info or the saved settings */
+static void autoconnect_node(struct obs_pw_audio_capture_device *pwac, struct target_node *n)
+{
+	bool stream_is_unconnected = pw_stream_get_state(pwac->pw.audio.stream, NULL) == PW_STREAM_STATE_UNCONNECTED &&
+				     pwac->standby.serial == SPA_ID_INVALID;
+
+	if (pwac->default_info.autoconnect) {
+		bool not_streamed = pwac->connected_serial != n->serial;
+		bool has_default_node_name = !dstr_is_empty(&pwac->default_info.name) &&
+					     dstr_cmp(&pwac->default_info.name, n->name) == 0;
+
+		if ((not_streamed && has_default_node_name) ||
+		    (stream_is_unconnected && match_target(pwac, n) == TARGET_MATCH_NAME)) {
+			start_streaming(pwac, n);
+		}
+		return;
+	}
+
+	connect_target(pwac, n);
+}
+
+/** The stream was connected with a guessed channel count that turned out wrong,
+  * reconnect to the same node through the standby stream */
+static void correct_channels(struct obs_pw_audio_capture_device *pwac, struct target_node *n)
+{
+	if (!n->channels) {
+		return;
+	}
+
+	if (n->serial == pwac->standby.serial && n->channels != pwac->standby.channels) {
+		cancel_handover(pwac);
+	} else if (n->serial != pwac->connected_serial || n->channels == pwac->connected_channels) {
+		return;
+	}
+
+	blog(LOG_INFO, "[pipewire-audio] Node %u has %u channels, reconnecting", n->serial, n->channels);
+
+	if (n->serial == pwac->connected_serial) {
+		/* Makes start_streaming hand over to a new connection instead of skipping the node */
+		set_connected_serial(pwac, SPA_ID_INVALID);
+	}
+
+	start_streaming(pwac, n);
+}
+
+/** Layout from a node's info, node globals don't have it */
+static uint32_t channels_from_props(const struct spa_dict *props)
+{
+	const char *str = spa_dict_lookup(props, PW_KEY_AUDIO_CHANNELS);
+	if (str) {
+		return strtoul(str, NULL, 10);
+	}
+
+	/* Position is a list like "[ FL, FR ]" or "FL,FR" */
+	str = spa_dict_lookup(props, "audio.position");
+	if (!str) {
+		return 0;
+	}
+
+	uint32_t channels = 0;
+	bool in_name = false;
+	for (; *str; str++) {
+		bool is_name = *str != ',' && *str != ' ' && *str != '[' && *str != ']';
+		if (is_name && !in_name) {
+			channels++;
+		}
+		in_name = is_name;
+	}
+
+	return channels;
 }
 
 /* Target node */
@@ -131,6 +469,8 @@ static void on_node_param_cb(void *data, int seq, uint32_t id, uint32_t index, u
 		return;
 	}
 
+	profile_start(profile_node_param);
+
 	struct target_node *n = data;
 
 	struct spa_pod_parser p;
@@ -144,7 +484,7 @@ static void on_node_param_cb(void *data, int seq, uint32_t id, uint32_t index, u
 
 	if (n->channels && !channels) {
 		// It's likely we got the channels from a proper format already
-		return;
+		goto end;
 	}
 
 	if (media_type != SPA_MEDIA_TYPE_audio) {
@@ -156,22 +496,147 @@ static void on_node_param_cb(void *data, int seq, uint32_t id, uint32_t index, u
 
 	struct obs_pw_audio_capture_device *pwac = n->pwac;
 
-	bool not_streamed = pwac->connected_serial != n->serial;
-	bool has_default_node_name = !dstr_is_empty(&pwac->default_info.name) &&
-				     dstr_cmp(&pwac->default_info.name, n->name) == 0;
-	bool is_new_default_node = not_streamed && has_default_node_name;
+	correct_channels(pwac, n);
+	autoconnect_node(pwac, n);
+
+end:
+	profile_end(profile_node_param);
+}
+
+/** Everything that identifies the node is known, it can be matched against the saved target */
+static void node_identified(struct target_node *n)
+{
+	struct obs_pw_audio_capture_device *pwac = n->pwac;
 
-	bool stream_is_unconnected = pw_stream_get_state(pwac->pw.audio.stream, NULL) == PW_STREAM_STATE_UNCONNECTED;
-	bool node_has_target_name = !dstr_is_empty(&pwac->target_name) && dstr_cmp(&pwac->target_name, n->name) == 0;
+	n->identified = true;
 
-	if ((pwac->default_info.autoconnect && is_new_default_node) ||
-	    (stream_is_unconnected && node_has_target_name)) {
-		start_streaming(pwac, n);
+	if (pwac->default_info.autoconnect) {
+		return;
+	}
+
+	enum target_match match = match_target(pwac, n);
+	if (match == TARGET_MATCH_NONE) {
+		return;
+	}
+
+	if (match == TARGET_MATCH_NAME) {
+		/* Remember what the saved target is made of, in case it comes back under another name */
+		set_target(pwac, n);
+	} else if (!n->channels) {
+		/* Last known layout of the saved target */
+		n->channels = pwac->target_channels;
+	}
+
+	connect_target(pwac, n);
+}
+
+/** @return Whether the props had anything identifying the device */
+static bool read_device_identity(struct target_node *n, const struct spa_dict *props)
+{
+	const char *bus_path = spa_dict_lookup(props, PW_KEY_DEVICE_BUS_PATH);
+	if (!bus_path) {
+		bus_path = spa_dict_lookup(props, "api.bluez5.address");
+	}
+	const char *device_serial = spa_dict_lookup(props, PW_KEY_DEVICE_SERIAL);
+
+	if (bus_path && !n->bus_path) {
+		n->bus_path = bstrdup(bus_path);
+	}
+	if (device_serial && !n->device_serial) {
+		n->device_serial = bstrdup(device_serial);
+	}
+
+	return n->bus_path || n->device_serial;
+}
+
+static void on_device_info_cb(void *data, const struct pw_device_info *info)
+{
+	struct target_node *n = data;
+
+	if (n->identified || (info->change_mask & PW_DEVICE_CHANGE_MASK_PROPS) == 0 || !info->props) {
+		return;
+	}
+
+	read_device_identity(n, info->props);
+	node_identified(n);
+}
+
+static const struct pw_device_events device_events = {
+	PW_VERSION_DEVICE_EVENTS,
+	.info = on_device_info_cb,
+};
+
+static void on_device_proxy_removed_cb(void *data)
+{
+	struct target_node *n = data;
+	pw_proxy_destroy(n->device_proxy);
+}
+
+static void on_device_proxy_destroy_cb(void *data)
+{
+	struct target_node *n = data;
+	spa_hook_remove(&n->device_listener);
+	spa_zero(n->device_listener);
+
+	spa_hook_remove(&n->device_proxy_listener);
+	spa_zero(n->device_proxy_listener);
+
+	n->device_proxy = NULL;
+}
+
+static const struct pw_proxy_events device_proxy_events = {
+	PW_VERSION_PROXY_EVENTS,
+	.removed = on_device_proxy_removed_cb,
+	.destroy = on_device_proxy_destroy_cb,
+};
+
+static void identify_node(struct target_node *n, const struct spa_dict *props)
+{
+	if (read_device_identity(n, props)) {
+		node_identified(n);
+		return;
+	}
+
+	/* Usually only the device has them, virtual nodes have none and are known by their name alone */
+	const char *device_id = spa_dict_lookup(props, PW_KEY_DEVICE_ID);
+	if (device_id) {
+		n->device_proxy = pw_registry_bind(n->pwac->pw.registry, strtoul(device_id, NULL, 10),
+						   PW_TYPE_INTERFACE_Device, PW_VERSION_DEVICE, 0);
+	}
+	if (!n->device_proxy) {
+		node_identified(n);
+		return;
+	}
+
+	pw_proxy_add_object_listener(n->device_proxy, &n->device_listener, &device_events, n);
+	pw_proxy_add_listener(n->device_proxy, &n->device_proxy_listener, &device_proxy_events, n);
+}
+
+/** The info arrives a round trip after binding and before the formats, its props have the node's layout */
+static void on_node_info_cb(void *data, const struct pw_node_info *info)
+{
+	struct target_node *n = data;
+
+	if ((info->change_mask & PW_NODE_CHANGE_MASK_PROPS) == 0 || !info->props) {
+		return;
+	}
+
+	if (!n->identified && !n->device_proxy) {
+		identify_node(n, info->props);
+	}
+
+	uint32_t channels = channels_from_props(info->props);
+	if (channels && channels != n->channels) {
+		n->channels = channels;
+
+		correct_channels(n->pwac, n);
+		autoconnect_node(n->pwac, n);
 	}
 }
 
 static const struct pw_node_events node_events = {
 	PW_VERSION_NODE_EVENTS,
+	.info = on_node_info_cb,
 	.param = on_node_param_cb,
 };
 
@@ -180,17 +645,35 @@ static void node_destroy_cb(void *data)
 	struct target_node *n = data;
 
 	struct obs_pw_audio_capture_device *pwac = n->pwac;
+	if (n->serial == pwac->standby.serial) {
+		cancel_handover(pwac);
+	}
+
 	if (n->serial == pwac->connected_serial) {
 		if (pw_stream_get_state(pwac->pw.audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
 			pw_stream_disconnect(pwac->pw.audio.stream);
 		}
-		pwac->connected_serial = SPA_ID_INVALID;
+		set_connected_serial(pwac, SPA_ID_INVALID);
+
+		/* Nothing to fade out, let a pending switch go through right away */
+		pwac->pw.audio.handover.silent = pwac->standby.serial != SPA_ID_INVALID;
 	}
 
 	spa_hook_remove(&n->node_listener);
 
+	if (n->device_proxy) {
+		pw_proxy_destroy(n->device_proxy);
+	}
+
+	obs_pw_audio_target_publisher_invalidate(&pwac->targets_snapshot);
+
 	bfree((void *)n->friendly_name);
 	bfree((void *)n->name);
+	bfree((void *)n->bus_path);
+	bfree((void *)n->device_serial);
+
+	/* The node is already out of the list, fall back to another one that matches */
+	connect_best_target(pwac);
 }
 
 static void register_target_node(struct obs_pw_audio_capture_device *pwac, const char *friendly_name, const char *name,
@@ -205,17 +688,47 @@ static void register_target_node(struct obs_pw_audio_capture_device *pwac, const
 	struct target_node *n = pw_proxy_get_user_data(node_proxy);
 	n->friendly_name = bstrdup(friendly_name);
 	n->name = bstrdup(name);
+	n->bus_path = NULL;
+	n->device_serial = NULL;
+	n->identified = false;
+	n->device_proxy = NULL;
 	n->id = global_id;
 	n->serial = object_serial;
-	n->channels = 0;
 	n->pwac = pwac;
 
+	/* The global doesn't have the layout, the saved target's last known one lets it connect right away.
+	 * Other nodes wait for their info */
+	n->channels = match_target(pwac, n) != TARGET_MATCH_NONE ? pwac->target_channels : 0;
+
 	obs_pw_audio_proxy_list_append(&pwac->targets, node_proxy);
+	obs_pw_audio_target_publisher_invalidate(&pwac->targets_snapshot);
 
 	spa_zero(n->node_listener);
 	pw_proxy_add_object_listener(node_proxy, &n->node_listener, &node_events, n);
 
 	pw_node_subscribe_params((struct pw_node *)node_proxy, (uint32_t[]){SPA_PARAM_EnumFormat}, 1);
+
+	/* Don't wait for the info round trip if the layout is already known */
+	if (n->channels) {
+		autoconnect_node(pwac, n);
+	}
+}
+/* ------------------------------------------------- */
+
+static void rebuild_targets_snapshot(void *data, struct obs_pw_audio_target_snapshot *snapshot)
+{
+	struct obs_pw_audio_capture_device *pwac = data;
+
+	struct obs_pw_audio_proxy_list_iter iter;
+	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->targets);
+
+	struct target_node *node;
+	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&node)) {
+		obs_pw_audio_target_snapshot_add(snapshot, node->serial, node->friendly_name, NULL, NULL);
+	}
+
+	snapshot->connected_serial = pwac->connected_serial;
+	snapshot->autoconnect = pwac->default_info.autoconnect;
 }
 /* ------------------------------------------------- */
 
@@ -240,12 +753,8 @@ static void default_node_cb(void *data, const char *name)
 /* ------------------------------------------------- */
 
 /* Registry */
-static void on_global_cb(void *data, uint32_t id, uint32_t permissions, const char *type, uint32_t version,
-			 const struct spa_dict *props)
+static void handle_global(void *data, uint32_t id, const char *type, const struct spa_dict *props)
 {
-	UNUSED_PARAMETER(permissions);
-	UNUSED_PARAMETER(version);
-
 	struct obs_pw_audio_capture_device *pwac = data;
 
 	if (!props || !type) {
@@ -297,13 +806,102 @@ static void on_global_cb(void *data, uint32_t id, uint32_t permissions, const ch
 	}
 }
 
+static void on_global_cb(void *data, uint32_t id, uint32_t permissions, const char *type, uint32_t version,
+			 const struct spa_dict *props)
+{
+	UNUSED_PARAMETER(permissions);
+	UNUSED_PARAMETER(version);
+
+	profile_start(profile_global);
+	handle_global(data, id, type, props);
+	profile_end(profile_global);
+}
+
 static const struct pw_registry_events registry_events = {
 	PW_VERSION_REGISTRY_EVENTS,
 	.global = on_global_cb,
 };
 /* ------------------------------------------------- */
 
+static void on_core_done_cb(void *data, uint32_t id, int seq)
+{
+	struct obs_pw_audio_capture_device *pwac = data;
+
+	if (id == PW_ID_CORE && seq == pwac->registry_seq && !pwac->registry_synced) {
+		pwac->registry_synced = true;
+		connect_best_target(pwac);
+	}
+}
+
+static const struct pw_core_events core_events = {
+	PW_VERSION_CORE_EVENTS,
+	.done = on_core_done_cb,
+};
+
+static void sync_registry(struct obs_pw_audio_capture_device *pwac)
+{
+	pwac->registry_synced = false;
+	pw_core_add_listener(pwac->pw.core, &pwac->core_listener, &core_events, pwac);
+	pwac->registry_seq = pw_core_sync(pwac->pw.core, PW_ID_CORE, 0);
+}
+/* ------------------------------------------------- */
+
+/* PipeWire restarts */
+static void on_core_lost_cb(void *data)
+{
+	struct obs_pw_audio_capture_device *pwac = data;
+
+	pwac->registry_synced = false;
+	spa_hook_remove(&pwac->core_listener);
+	spa_zero(pwac->core_listener);
+
+	cancel_handover(pwac);
+	obs_pw_audio_stream_destroy(&pwac->standby.audio);
+
+	obs_pw_audio_proxy_list_clear(&pwac->targets);
+
+	if (pwac->default_info.metadata.proxy) {
+		pw_proxy_destroy(pwac->default_info.metadata.proxy);
+	}
+
+	/* Serials start over with the new daemon */
+	set_connected_serial(pwac, SPA_ID_INVALID);
+	pwac->default_info.node_serial = SPA_ID_INVALID;
+}
+
+static void on_core_restored_cb(void *data)
+{
+	struct obs_pw_audio_capture_device *pwac = data;
+
+	if (!obs_pw_audio_stream_init(&pwac->standby.audio, pwac->pw.core, pwac->capture_type == CAPTURE_TYPE_OUTPUT,
+				      true, pwac->source)) {
+		blog(LOG_WARNING, "[pipewire-audio] Failed to recreate standby stream");
+	}
+
+	/* The saved target or the default device is connected again as the registry announces it */
+	sync_registry(pwac);
+}
+/* ------------------------------------------------- */
+
 /* Source */
+static void set_packet_latency(struct obs_pw_audio_capture_device *pwac, uint32_t latency_ms)
+{
+	obs_pw_audio_stream_set_packet_latency(&pwac->pw.audio, latency_ms);
+	obs_pw_audio_stream_set_packet_latency(&pwac->standby.audio, latency_ms);
+}
+
+static void set_lock_memory(struct obs_pw_audio_capture_device *pwac, bool lock)
+{
+	obs_pw_audio_stream_set_lock_memory(&pwac->pw.audio, lock);
+	obs_pw_audio_stream_set_lock_memory(&pwac->standby.audio, lock);
+}
+
+static void set_latency_compensation(struct obs_pw_audio_capture_device *pwac, bool compensate)
+{
+	obs_pw_audio_stream_set_latency_compensation(&pwac->pw.audio, compensate);
+	obs_pw_audio_stream_set_latency_compensation(&pwac->standby.audio, compensate);
+}
+
 static void *pipewire_audio_capture_create(obs_data_t *settings, obs_source_t *source, enum capture_type capture_type)
 {
 	struct obs_pw_audio_capture_device *pwac = bzalloc(sizeof(struct obs_pw_audio_capture_device));
@@ -321,7 +919,23 @@ static void *pipewire_audio_capture_create(obs_data_t *settings, obs_source_t *s
 	pwac->default_info.node_serial = SPA_ID_INVALID;
 	pwac->connected_serial = SPA_ID_INVALID;
 
+	pwac->standby.serial = SPA_ID_INVALID;
+	if (!obs_pw_audio_stream_init(&pwac->standby.audio, pwac->pw.core, capture_type == CAPTURE_TYPE_OUTPUT, true,
+				      source)) {
+		obs_pw_audio_instance_destroy(&pwac->pw);
+
+		bfree(pwac);
+		return NULL;
+	}
+	pwac->standby.event =
+		pw_loop_add_event(pw_thread_loop_get_loop(pwac->pw.thread_loop), on_handover_event_cb, pwac);
+
+	obs_pw_audio_stream_set_watchdog(&pwac->pw.audio, on_stream_stalled_cb, NULL, pwac);
+	obs_pw_audio_instance_set_reconnect_callbacks(&pwac->pw, on_core_lost_cb, on_core_restored_cb);
+
 	obs_pw_audio_proxy_list_init(&pwac->targets, NULL, node_destroy_cb);
+	obs_pw_audio_target_publisher_init(&pwac->targets_snapshot, pw_thread_loop_get_loop(pwac->pw.thread_loop),
+					   rebuild_targets_snapshot, pwac);
 
 	if (obs_data_get_int(settings, SETTING_TARGET_SERIAL) != PW_ID_ANY) {
 		/** Reset id setting, PipeWire node ids may not persist between sessions.
@@ -331,8 +945,19 @@ static void *pipewire_audio_capture_create(obs_data_t *settings, obs_source_t *s
 	} else {
 		pwac->default_info.autoconnect = true;
 	}
+	obs_pw_audio_target_publisher_invalidate(&pwac->targets_snapshot);
 
 	dstr_init_copy(&pwac->target_name, obs_data_get_string(settings, SETTING_TARGET_NAME));
+	dstr_init_copy(&pwac->target_device_serial, obs_data_get_string(settings, SETTING_TARGET_DEVICE_SERIAL));
+	dstr_init_copy(&pwac->target_bus_path, obs_data_get_string(settings, SETTING_TARGET_BUS_PATH));
+	dstr_init_copy(&pwac->target_friendly_name, obs_data_get_string(settings, SETTING_TARGET_FRIENDLY_NAME));
+	pwac->target_channels = obs_data_get_int(settings, SETTING_TARGET_CHANNELS);
+
+	set_packet_latency(pwac, obs_data_get_int(settings, SETTING_PACKET_LATENCY));
+	set_lock_memory(pwac, obs_data_get_bool(settings, SETTING_LOCK_MEMORY));
+	set_latency_compensation(pwac, obs_data_get_bool(settings, SETTING_COMPENSATE_LATENCY));
+
+	sync_registry(pwac);
 
 	pw_thread_loop_unlock(pwac->pw.thread_loop);
 
@@ -352,6 +977,9 @@ static void *pipewire_audio_capture_output_create(obs_data_t *settings, obs_sour
 static void pipewire_audio_capture_defaults(obs_data_t *settings)
 {
 	obs_data_set_default_int(settings, SETTING_TARGET_SERIAL, PW_ID_ANY);
+	obs_data_set_default_int(settings, SETTING_PACKET_LATENCY, 0);
+	obs_data_set_default_bool(settings, SETTING_LOCK_MEMORY, false);
+	obs_data_set_default_bool(settings, SETTING_COMPENSATE_LATENCY, false);
 }
 
 static obs_properties_t *pipewire_audio_capture_properties(void *data)
@@ -365,25 +993,36 @@ static obs_properties_t *pipewire_audio_capture_properties(void *data)
 
 	obs_property_list_add_int(targets_list, obs_module_text("Default"), PW_ID_ANY);
 
-	if (!pwac->default_info.autoconnect) {
+	struct obs_pw_audio_target_snapshot *snapshot = obs_pw_audio_target_publisher_get(&pwac->targets_snapshot);
+
+	if (!snapshot->autoconnect) {
 		obs_data_t *settings = obs_source_get_settings(pwac->source);
 		/* Saved target serial may be different from connected because a previously connected
 		   node may have been replaced by one with the same name */
-		obs_data_set_int(settings, SETTING_TARGET_SERIAL, pwac->connected_serial);
+		obs_data_set_int(settings, SETTING_TARGET_SERIAL, snapshot->connected_serial);
 		obs_data_release(settings);
 	}
 
-	pw_thread_loop_lock(pwac->pw.thread_loop);
+	for (size_t i = 0; i < snapshot->targets.num; i++) {
+		struct obs_pw_audio_target *target = &snapshot->targets.array[i];
+		obs_property_list_add_int(targets_list, target->name, target->serial);
+	}
 
-	struct obs_pw_audio_proxy_list_iter iter;
-	obs_pw_audio_proxy_list_iter_init(&iter, &pwac->targets);
+	obs_pw_audio_target_snapshot_release(snapshot);
 
-	struct target_node *node;
-	while (obs_pw_audio_proxy_list_iter_next(&iter, (void **)&node)) {
-		obs_property_list_add_int(targets_list, node->friendly_name, node->serial);
-	}
+	obs_property_t *packet_latency = obs_properties_add_int_slider(p, SETTING_PACKET_LATENCY,
+								       obs_module_text("PacketLatency"), 0, 50, 1);
+	obs_property_int_set_suffix(packet_latency, " ms");
+	obs_property_set_long_description(packet_latency, obs_module_text("PacketLatencyDescription"));
 
-	pw_thread_loop_unlock(pwac->pw.thread_loop);
+	obs_property_t *lock_memory = obs_properties_add_bool(p, SETTING_LOCK_MEMORY, obs_module_text("LockMemory"));
+	obs_property_set_long_description(lock_memory, obs_module_text("LockMemoryDescription"));
+
+	obs_property_t *compensate_latency = obs_properties_add_bool(p, SETTING_COMPENSATE_LATENCY,
+								     obs_module_text("CompensateLatency"));
+	obs_property_set_long_description(compensate_latency, obs_module_text("CompensateLatencyDescription"));
+
+	obs_pw_audio_stream_add_stats(&pwac->pw.audio, p);
 
 	return p;
 }
@@ -396,13 +1035,21 @@ static void pipewire_audio_capture_update(void *data, obs_data_t *settings)
 
 	pw_thread_loop_lock(pwac->pw.thread_loop);
 
-	if ((pwac->default_info.autoconnect = new_node_serial == PW_ID_ANY)) {
+	set_packet_latency(pwac, obs_data_get_int(settings, SETTING_PACKET_LATENCY));
+	set_lock_memory(pwac, obs_data_get_bool(settings, SETTING_LOCK_MEMORY));
+	set_latency_compensation(pwac, obs_data_get_bool(settings, SETTING_COMPENSATE_LATENCY));
+
+	pwac->default_info.autoconnect = new_node_serial == PW_ID_ANY;
+	obs_pw_audio_target_publisher_invalidate(&pwac->targets_snapshot);
+
+	if (pwac->default_info.autoconnect) {
 		if (pwac->default_info.node_serial != SPA_ID_INVALID) {
 			start_streaming(pwac, get_node_by_serial(pwac, pwac->default_info.node_serial));
 		}
 	} else {
 		struct target_node *new_node = get_node_by_serial(pwac, new_node_serial);
 		if (new_node) {
+			set_target(pwac, new_node);
 			start_streaming(pwac, new_node);
 
 			obs_data_set_string(settings, SETTING_TARGET_NAME, pwac->target_name.array);
@@ -412,12 +1059,31 @@ static void pipewire_audio_capture_update(void *data, obs_data_t *settings)
 	pw_thread_loop_unlock(pwac->pw.thread_loop);
 }
 
+static void pipewire_audio_capture_save(void *data, obs_data_t *settings)
+{
+	struct obs_pw_audio_capture_device *pwac = data;
+
+	pw_thread_loop_lock(pwac->pw.thread_loop);
+
+	if (!pwac->default_info.autoconnect) {
+		/* The target may have been recognized under a new name, save what it looks like now */
+		obs_data_set_string(settings, SETTING_TARGET_NAME, pwac->target_name.array);
+		obs_data_set_string(settings, SETTING_TARGET_DEVICE_SERIAL, pwac->target_device_serial.array);
+		obs_data_set_string(settings, SETTING_TARGET_BUS_PATH, pwac->target_bus_path.array);
+		obs_data_set_string(settings, SETTING_TARGET_FRIENDLY_NAME, pwac->target_friendly_name.array);
+		obs_data_set_int(settings, SETTING_TARGET_CHANNELS, pwac->target_channels);
+	}
+
+	pw_thread_loop_unlock(pwac->pw.thread_loop);
+}
+
 static void pipewire_audio_capture_show(void *data)
 {
 	struct obs_pw_audio_capture_device *pwac = data;
 
 	pw_thread_loop_lock(pwac->pw.thread_loop);
-	pw_stream_set_active(pwac->pw.audio.stream, true);
+	obs_pw_audio_stream_set_active(&pwac->pw.audio, true);
+	obs_pw_audio_stream_set_active(&pwac->standby.audio, true);
 	pw_thread_loop_unlock(pwac->pw.thread_loop);
 }
 
@@ -425,7 +1091,8 @@ static void pipewire_audio_capture_hide(void *data)
 {
 	struct obs_pw_audio_capture_device *pwac = data;
 	pw_thread_loop_lock(pwac->pw.thread_loop);
-	pw_stream_set_active(pwac->pw.audio.stream, false);
+	obs_pw_audio_stream_set_active(&pwac->pw.audio, false);
+	obs_pw_audio_stream_set_active(&pwac->standby.audio, false);
 	pw_thread_loop_unlock(pwac->pw.thread_loop);
 }
 
@@ -435,7 +1102,14 @@ static void pipewire_audio_capture_destroy(void *data)
 
 	pw_thread_loop_lock(pwac->pw.thread_loop);
 
+	pwac->registry_synced = false;
+	spa_hook_remove(&pwac->core_listener);
+
 	obs_pw_audio_proxy_list_clear(&pwac->targets);
+	obs_pw_audio_target_publisher_destroy(&pwac->targets_snapshot);
+
+	pw_loop_destroy_source(pw_thread_loop_get_loop(pwac->pw.thread_loop), pwac->standby.event);
+	obs_pw_audio_stream_destroy(&pwac->standby.audio);
 
 	if (pwac->default_info.metadata.proxy) {
 		pw_proxy_destroy(pwac->default_info.metadata.proxy);
@@ -445,6 +1119,9 @@ static void pipewire_audio_capture_destroy(void *data)
 
 	dstr_free(&pwac->default_info.name);
 	dstr_free(&pwac->target_name);
+	dstr_free(&pwac->target_device_serial);
+	dstr_free(&pwac->target_bus_path);
+	dstr_free(&pwac->target_friendly_name);
 
 	bfree(pwac);
 }
@@ -463,6 +1140,10 @@ static const char *pipewire_audio_capture_output_name(void *data)
 
 void pipewire_audio_capture_load(void)
 {
+	profile_register_root(profile_global, 0);
+	profile_register_root(profile_node_param, 0);
+	profile_register_root(profile_start_streaming, 0);
+
 	const struct obs_source_info pipewire_audio_capture_input = {
 		.id = "pipewire_audio_input_capture",
 		.type = OBS_SOURCE_TYPE_INPUT,
@@ -472,6 +1153,7 @@ void pipewire_audio_capture_load(void)
 		.get_defaults = pipewire_audio_capture_defaults,
 		.get_properties = pipewire_audio_capture_properties,
 		.update = pipewire_audio_capture_update,
+		.save = pipewire_audio_capture_save,
 		.show = pipewire_audio_capture_show,
 		.hide = pipewire_audio_capture_hide,
 		.destroy = pipewire_audio_capture_destroy,
@@ -486,6 +1168,7 @@ void pipewire_audio_capture_load(void)
 		.get_defaults = pipewire_audio_capture_defaults,
 		.get_properties = pipewire_audio_capture_properties,
 		.update = pipewire_audio_capture_update,
+		.save = pipewire_audio_capture_save,
 		.show = pipewire_audio_capture_show,
 		.hide = pipewire_audio_capture_hide,
 		.destroy = pipewire_audio_capture_destroy,
@@ -0,0 +1,559 @@
+/* pipewire-audio-e2e.c
+ *
+ * Copyright 2022-2026 Dimitris Papaioannou <dimtpap@protonmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/** End-to-end check of the sources, built with -DENABLE_E2E=ON and run by scripts/pipewire-audio-e2e.sh
+  * against a private PipeWire instance.
+  * The plugin is loaded into a headless libobs, output and app capture sources are created and a null sink is
+  * played into by a number of player streams. One of them plays an impulse every so often, which every source
+  * has to capture. The silent ones can be replaced periodically, to churn the graph while capturing.
+  * Reports the time from creating the sink and players to the first audio and the first impulse, and the captured
+  * impulses with their latency and jitter per source. Fails if a source captured nothing */
+
+#include <obs.h>
+#include <util/base.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+
+#define E2E_RATE 48000
+#define E2E_CHANNELS 2
+#define E2E_IMPULSE_PERIOD_MS 500
+#define E2E_IMPULSE_AMPLITUDE 0.9f
+#define E2E_IMPULSE_THRESHOLD 0.01f
+#define E2E_MAX_IMPULSES 1024
+
+#define E2E_SINK_NAME "obs-e2e-sink"
+#define E2E_APP_NAME "OBS e2e player"
+
+/* enum capture_mode and enum match_priority of pipewire-audio-capture-app.c */
+#define E2E_CAPTURE_MODE_SINGLE 0
+#define E2E_MATCH_PRIORITY_APP_NAME 1
+
+struct player {
+	struct pw_stream *stream;
+	struct spa_hook stream_listener;
+
+	bool impulses;
+	uint64_t frames;
+};
+
+struct capture {
+	obs_source_t *source;
+	const char *type;
+
+	uint64_t first_audio_ns;
+	uint64_t first_impulse_ns;
+
+	long last_impulse;
+	uint32_t impulses;
+
+	double latency_min_ms;
+	double latency_max_ms;
+	double latency_sum_ms;
+	double latency_sq_sum_ms;
+};
+
+static struct {
+	struct pw_thread_loop *thread_loop;
+	struct pw_context *context;
+	struct pw_core *core;
+	struct pw_proxy *sink;
+
+	struct player **players;
+	uint32_t n_players;
+
+	/* When the sink and players were created, what the sources wait for */
+	uint64_t started_ns;
+
+	/* Written by the impulse player, the count is published after the time */
+	uint64_t impulse_ns[E2E_MAX_IMPULSES];
+	volatile long impulses;
+
+	bool verbose;
+} e2e;
+
+static void log_handler(int level, const char *format, va_list args, void *param)
+{
+	UNUSED_PARAMETER(param);
+
+	if (level > LOG_WARNING && !e2e.verbose) {
+		return;
+	}
+
+	vfprintf(stderr, format, args);
+	fputc('\n', stderr);
+}
+
+/* Players */
+static void on_player_process_cb(void *data)
+{
+	struct player *p = data;
+
+	struct pw_buffer *b = pw_stream_dequeue_buffer(p->stream);
+	if (!b) {
+		return;
+	}
+
+	struct spa_data *d = &b->buffer->datas[0];
+	if (!d->data) {
+		pw_stream_queue_buffer(p->stream, b);
+		return;
+	}
+
+	uint32_t stride = sizeof(float) * E2E_CHANNELS;
+	uint32_t frames = d->maxsize / stride;
+#if PW_CHECK_VERSION(0, 3, 49)
+	if (b->requested) {
+		frames = SPA_MIN(frames, (uint32_t)b->requested);
+	}
+#endif
+
+	float *samples = d->data;
+	memset(samples, 0, (size_t)frames * stride);
+
+	if (p->impulses) {
+		uint64_t now = os_gettime_ns();
+		uint64_t period = (uint64_t)E2E_RATE * E2E_IMPULSE_PERIOD_MS / 1000;
+
+		for (uint32_t i = 0; i < frames; i++) {
+			if ((p->frames + i) % period != 0) {
+				continue;
+			}
+
+			for (uint32_t c = 0; c < E2E_CHANNELS; c++) {
+				samples[i * E2E_CHANNELS + c] = E2E_IMPULSE_AMPLITUDE;
+			}
+
+			long n = os_atomic_load_long(&e2e.impulses);
+			e2e.impulse_ns[n % E2E_MAX_IMPULSES] = now + (uint64_t)i * SPA_NSEC_PER_SEC / E2E_RATE;
+			os_atomic_set_long(&e2e.impulses, n + 1);
+		}
+	}
+	p->frames += frames;
+
+	d->chunk->offset = 0;
+	d->chunk->stride = (int32_t)stride;
+	d->chunk->size = frames * stride;
+
+	pw_stream_queue_buffer(p->stream, b);
+}
+
+static const struct pw_stream_events player_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.process = on_player_process_cb,
+};
+
+static struct player *player_create(uint32_t index, bool impulses)
+{
+	struct player *p = bzalloc(sizeof(struct player));
+	p->impulses = impulses;
+
+	struct pw_properties *props = pw_properties_new(
+		PW_KEY_MEDIA_TYPE, "Audio", PW_KEY_MEDIA_CATEGORY, "Playback", PW_KEY_MEDIA_ROLE, "Music",
+		PW_KEY_APP_NAME, E2E_APP_NAME, PW_KEY_TARGET_OBJECT, E2E_SINK_NAME, NULL);
+	pw_properties_setf(props, PW_KEY_NODE_NAME, "obs-e2e-player.%u", index);
+
+	p->stream = pw_stream_new(e2e.core, E2E_APP_NAME, props);
+	if (!p->stream) {
+		bfree(p);
+		return NULL;
+	}
+	pw_stream_add_listener(p->stream, &p->stream_listener, &player_events, p);
+
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+
+	struct spa_audio_info_raw info = {
+		.format = SPA_AUDIO_FORMAT_F32,
+		.rate = E2E_RATE,
+		.channels = E2E_CHANNELS,
+		.position = {SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR},
+	};
+	const struct spa_pod *params[1] = {spa_format_audio_raw_build(&b, SPA_PARAM_EnumFormat, &info)};
+
+	if (pw_stream_connect(p->stream, PW_DIRECTION_OUTPUT, PW_ID_ANY,
+			      PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS, params,
+			      1) < 0) {
+		pw_stream_destroy(p->stream);
+		bfree(p);
+		return NULL;
+	}
+
+	return p;
+}
+
+static void player_destroy(struct player *p)
+{
+	if (!p) {
+		return;
+	}
+
+	spa_hook_remove(&p->stream_listener);
+	pw_stream_destroy(p->stream);
+	bfree(p);
+}
+
+static bool start_players(uint32_t n_players)
+{
+	e2e.thread_loop = pw_thread_loop_new("OBS e2e", NULL);
+	e2e.context = pw_context_new(pw_thread_loop_get_loop(e2e.thread_loop), NULL, 0);
+	if (pw_thread_loop_start(e2e.thread_loop) < 0) {
+		fprintf(stderr, "Failed to start the PipeWire thread loop\n");
+		return false;
+	}
+
+	pw_thread_loop_lock(e2e.thread_loop);
+
+	e2e.started_ns = os_gettime_ns();
+	e2e.core = pw_context_connect(e2e.context, NULL, 0);
+	if (!e2e.core) {
+		pw_thread_loop_unlock(e2e.thread_loop);
+		fprintf(stderr, "Failed to connect to PipeWire, is the private instance running?\n");
+		return false;
+	}
+
+	struct pw_properties *props = pw_properties_new(
+		PW_KEY_FACTORY_NAME, "support.null-audio-sink", PW_KEY_NODE_NAME, E2E_SINK_NAME,
+		PW_KEY_NODE_DESCRIPTION, "OBS e2e sink", PW_KEY_MEDIA_CLASS, "Audio/Sink", SPA_KEY_AUDIO_POSITION,
+		"FL,FR", "priority.session", "2000", NULL);
+	e2e.sink = pw_core_create_object(e2e.core, "adapter", PW_TYPE_INTERFACE_Node, PW_VERSION_NODE, &props->dict, 0);
+	pw_properties_free(props);
+
+	e2e.n_players = n_players;
+	e2e.players = bzalloc(sizeof(struct player *) * n_players);
+	for (uint32_t i = 0; i < n_players; i++) {
+		e2e.players[i] = player_create(i, i == 0);
+	}
+
+	pw_thread_loop_unlock(e2e.thread_loop);
+
+	if (!e2e.sink || !e2e.players[0]) {
+		fprintf(stderr, "Failed to create the sink or the impulse player\n");
+		return false;
+	}
+
+	return true;
+}
+
+/** Replaces a silent player, for the sources to see a stream go away and a new one appear */
+static void churn_player(uint32_t i)
+{
+	pw_thread_loop_lock(e2e.thread_loop);
+	player_destroy(e2e.players[i]);
+	e2e.players[i] = player_create(i, false);
+	pw_thread_loop_unlock(e2e.thread_loop);
+}
+
+static void stop_players(void)
+{
+	if (e2e.thread_loop) {
+		pw_thread_loop_lock(e2e.thread_loop);
+		for (uint32_t i = 0; i < e2e.n_players; i++) {
+			player_destroy(e2e.players[i]);
+		}
+		if (e2e.sink) {
+			pw_proxy_destroy(e2e.sink);
+		}
+		if (e2e.core) {
+			pw_core_disconnect(e2e.core);
+		}
+		pw_thread_loop_unlock(e2e.thread_loop);
+		pw_thread_loop_stop(e2e.thread_loop);
+	}
+
+	if (e2e.context) {
+		pw_context_destroy(e2e.context);
+	}
+	if (e2e.thread_loop) {
+		pw_thread_loop_destroy(e2e.thread_loop);
+	}
+
+	bfree(e2e.players);
+}
+/* ------------------------------------------------- */
+
+/* Sources */
+static void on_audio_capture_cb(void *param, obs_source_t *source, const struct audio_data *audio, bool muted)
+{
+	UNUSED_PARAMETER(source);
+	UNUSED_PARAMETER(muted);
+
+	struct capture *c = param;
+	uint64_t now = os_gettime_ns();
+
+	if (!c->first_audio_ns) {
+		c->first_audio_ns = now;
+	}
+
+	const float *samples = (const float *)audio->data[0];
+	if (!samples) {
+		return;
+	}
+
+	uint32_t i = 0;
+	while (i < audio->frames && samples[i] < E2E_IMPULSE_THRESHOLD) {
+		i++;
+	}
+	if (i == audio->frames) {
+		return;
+	}
+
+	/* The period is long enough for the impulse to be the last one played */
+	long n = os_atomic_load_long(&e2e.impulses);
+	if (n == 0 || n - 1 == c->last_impulse) {
+		return;
+	}
+	c->last_impulse = n - 1;
+
+	double latency_ms = (double)((int64_t)now - (int64_t)e2e.impulse_ns[(n - 1) % E2E_MAX_IMPULSES]) / 1e6;
+	if (!c->impulses) {
+		c->first_impulse_ns = now;
+		c->latency_min_ms = latency_ms;
+		c->latency_max_ms = latency_ms;
+	}
+
+	c->impulses++;
+	c->latency_min_ms = fmin(c->latency_min_ms, latency_ms);
+	c->latency_max_ms = fmax(c->latency_max_ms, latency_ms);
+	c->latency_sum_ms += latency_ms;
+	c->latency_sq_sum_ms += latency_ms * latency_ms;
+}
+
+static obs_data_t *make_settings(const char *type)
+{
+	obs_data_t *settings = obs_data_create();
+
+	/* Output capture follows the default sink, which is the only one */
+	if (strcmp(type, "app") == 0) {
+		obs_data_set_int(settings, "CaptureMode", E2E_CAPTURE_MODE_SINGLE);
+		obs_data_set_int(settings, "MatchPriorty", E2E_MATCH_PRIORITY_APP_NAME);
+		obs_data_set_string(settings, "TargetName", E2E_APP_NAME);
+	}
+
+	return settings;
+}
+
+static bool create_capture(struct capture *c, uint32_t channel, const char *type)
+{
+	const char *id = strcmp(type, "app") == 0 ? "pipewire_audio_application_capture"
+						   : "pipewire_audio_output_capture";
+
+	char name[64];
+	snprintf(name, sizeof(name), "e2e %s %u", type, channel);
+
+	obs_data_t *settings = make_settings(type);
+
+	c->type = type;
+	c->last_impulse = -1;
+	c->source = obs_source_create(id, name, settings, NULL);
+
+	obs_data_release(settings);
+
+	if (!c->source) {
+		fprintf(stderr, "Failed to create %s\n", name);
+		return false;
+	}
+
+	obs_source_add_audio_capture_callback(c->source, on_audio_capture_cb, c);
+
+	/* Device sources only stream while active. There's no video thread to deliver show and hide,
+	 * the source is activated before the sink exists so that it connects active */
+	obs_set_output_source(channel, c->source);
+
+	return true;
+}
+
+static void destroy_capture(struct capture *c, uint32_t channel)
+{
+	if (!c->source) {
+		return;
+	}
+
+	obs_set_output_source(channel, NULL);
+	obs_source_remove_audio_capture_callback(c->source, on_audio_capture_cb, c);
+	obs_source_release(c->source);
+	c->source = NULL;
+}
+
+static double ms_since(uint64_t start_ns, uint64_t end_ns)
+{
+	return end_ns ? (double)(end_ns - start_ns) / 1e6 : NAN;
+}
+
+static bool report(const struct capture *captures, uint32_t n_captures, uint32_t churned)
+{
+	long emitted = os_atomic_load_long(&e2e.impulses);
+	bool ok = true;
+
+	printf("%-3s %-7s %10s %12s %9s %10s %10s %10s %10s\n", "#", "source", "ttfa ms", "impulse ms", "impulses",
+	       "min ms", "mean ms", "max ms", "jitter ms");
+
+	for (uint32_t i = 0; i < n_captures; i++) {
+		const struct capture *c = &captures[i];
+
+		double n = (double)SPA_MAX(c->impulses, 1u);
+		double mean = c->latency_sum_ms / n;
+		double jitter = sqrt(fmax(c->latency_sq_sum_ms / n - mean * mean, 0.0));
+
+		printf("%-3u %-7s %10.1f %12.1f %4u/%-4ld %10.2f %10.2f %10.2f %10.2f\n", i, c->type,
+		       ms_since(e2e.started_ns, c->first_audio_ns), ms_since(e2e.started_ns, c->first_impulse_ns),
+		       c->impulses, emitted, c->latency_min_ms, mean, c->latency_max_ms, jitter);
+
+		if (!c->impulses) {
+			ok = false;
+		}
+	}
+
+	printf("%ld impulses played, %u players replaced\n", emitted, churned);
+
+	if (!ok) {
+		fprintf(stderr, "FAIL: a source captured no impulses\n");
+	}
+
+	return ok;
+}
+/* ------------------------------------------------- */
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-s sources] [-t output|app|both] [-a players] [-d seconds] [-c churn_ms] [-v] "
+		"module [data_path]\n",
+		argv0);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t n_captures = 2;
+	const char *type = "both";
+	uint32_t n_players = 4;
+	uint32_t duration_s = 10;
+	uint32_t churn_ms = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:t:a:d:c:v")) != -1) {
+		switch (opt) {
+		case 's':
+			n_captures = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			type = optarg;
+			break;
+		case 'a':
+			n_players = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			duration_s = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			churn_ms = strtoul(optarg, NULL, 10);
+			break;
+		case 'v':
+			e2e.verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc || (strcmp(type, "output") != 0 && strcmp(type, "app") != 0 && strcmp(type, "both") != 0)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *module_path = argv[optind];
+	const char *data_path = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+	/* Every source takes an output channel to be active */
+	n_captures = SPA_CLAMP(n_captures, 1u, (uint32_t)MAX_CHANNELS);
+	n_players = SPA_MAX(n_players, 1u);
+
+	base_set_log_handler(log_handler, NULL);
+	pw_init(&argc, &argv);
+
+	int ret = EXIT_FAILURE;
+	struct capture *captures = bzalloc(sizeof(struct capture) * n_captures);
+
+	if (!obs_startup("en-US", NULL, NULL)) {
+		fprintf(stderr, "Failed to start libobs\n");
+		goto end;
+	}
+
+	struct obs_audio_info oai = {.samples_per_sec = E2E_RATE, .speakers = SPEAKERS_STEREO};
+	if (!obs_reset_audio(&oai)) {
+		fprintf(stderr, "Failed to reset the audio of libobs\n");
+		goto shutdown;
+	}
+
+	obs_module_t *module;
+	if (obs_open_module(&module, module_path, data_path) != MODULE_SUCCESS || !obs_init_module(module)) {
+		fprintf(stderr, "Failed to load %s\n", module_path);
+		goto shutdown;
+	}
+
+	for (uint32_t i = 0; i < n_captures; i++) {
+		const char *capture_type = strcmp(type, "both") == 0 ? (i % 2 ? "app" : "output") : type;
+		if (!create_capture(&captures[i], i, capture_type)) {
+			goto destroy;
+		}
+	}
+
+	if (!start_players(n_players)) {
+		goto destroy;
+	}
+
+	uint64_t end_ns = os_gettime_ns() + (uint64_t)duration_s * SPA_NSEC_PER_SEC;
+	uint32_t churned = 0;
+	while (os_gettime_ns() < end_ns) {
+		if (!churn_ms || n_players < 2) {
+			os_sleep_ms(100);
+			continue;
+		}
+
+		os_sleep_ms(churn_ms);
+		churn_player(1 + churned % (n_players - 1));
+		churned++;
+	}
+
+	ret = report(captures, n_captures, churned) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+destroy:
+	for (uint32_t i = 0; i < n_captures; i++) {
+		destroy_capture(&captures[i], i);
+	}
+	stop_players();
+
+shutdown:
+	obs_shutdown();
+
+end:
+	bfree(captures);
+#if PW_CHECK_VERSION(0, 3, 49)
+	pw_deinit();
+#endif
+
+	return ret;
+}
@@ -0,0 +1,1366 @@
+/* pipewire-audio-registry-bench.c
+ *
+ * Copyright 2022-2026 Dimitris Papaioannou <dimtpap@protonmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/** Offline benchmark of the registry handlers, built with -DENABLE_BENCH=ON.
+  * The plugin's sources are compiled against the stub PipeWire layer of pipewire-audio-registry-bench.h,
+  * a synthetic graph of clients, devices, nodes and ports kept here stands in for the server.
+  * Globals are announced to the registries, bound proxies get their bound and info events, objects created
+  * through a core become globals and removing a global reaches the proxies bound to it.
+  * Streams never leave the connecting state and timers never fire.
+  * For each source type, the CPU time, allocator calls and heap growth per event are measured over the initial
+  * sync of the graph, churn of app streams, building the properties and teardown */
+
+#include "pipewire-audio-registry-bench.h"
+
+#include <util/base.h>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#define BENCH_NODES 2000
+#define BENCH_PORTS 8000
+#define BENCH_CLIENTS 500
+#define BENCH_SELECTED_APPS 32
+#define BENCH_PROPERTIES_CALLS 20
+
+/* enum capture_mode of pipewire-audio-capture-app.c */
+#define BENCH_CAPTURE_MODE_MULTIPLE 1
+
+/* Allocator accounting, the plugin, libobs and PipeWire all allocate through these */
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+static struct {
+	uint64_t calls;
+	int64_t live;
+	int64_t peak;
+} heap;
+
+static void heap_add(void *ptr)
+{
+	if (!ptr) {
+		return;
+	}
+
+	heap.calls++;
+	heap.live += (int64_t)malloc_usable_size(ptr);
+	if (heap.live > heap.peak) {
+		heap.peak = heap.live;
+	}
+}
+
+void *malloc(size_t size)
+{
+	void *ptr = __libc_malloc(size);
+	heap_add(ptr);
+	return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	void *ptr = __libc_calloc(nmemb, size);
+	heap_add(ptr);
+	return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+
+	void *new_ptr = __libc_realloc(ptr, size);
+	if (new_ptr || !size) {
+		heap.live -= (int64_t)old_size;
+	}
+	heap_add(new_ptr);
+
+	return new_ptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	void *ptr = __libc_memalign(alignment, size);
+	heap_add(ptr);
+	return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+		return EINVAL;
+	}
+
+	void *ptr = memalign(alignment, size);
+	if (!ptr) {
+		return ENOMEM;
+	}
+
+	*memptr = ptr;
+	return 0;
+}
+
+void free(void *ptr)
+{
+	if (ptr) {
+		heap.live -= (int64_t)malloc_usable_size(ptr);
+	}
+	__libc_free(ptr);
+}
+/* ------------------------------------------------- */
+
+/* The server */
+struct bench_global {
+	uint32_t id;
+	const char *type;
+	uint32_t version;
+	struct pw_properties *props;
+
+	/* What the info of a bound proxy carries in addition to the props */
+	struct pw_properties *info;
+
+	/* Removed along with the global, the ports of a node and the links of a port */
+	DARRAY(uint32_t) children;
+
+	/* Bound to the global, or the one that created it */
+	struct spa_list proxies;
+};
+
+struct bench_core {
+	struct spa_hook_list listeners;
+	struct spa_list proxies;
+	int seq;
+};
+
+struct bench_proxy {
+	const char *type;
+	uint32_t id;
+	uint32_t refs;
+	bool destroyed;
+
+	struct bench_core *core;
+	struct spa_list core_link;
+	struct spa_list global_link;
+
+	/* Registries only, once they have been told about the existing globals */
+	struct spa_list registry_link;
+
+	/* Objects created through the core become globals once bound,
+	 * those that don't linger are removed along with their proxy */
+	struct pw_properties *create_props;
+	bool lingers;
+
+	struct spa_hook_list listeners;
+	struct spa_hook_list object_listeners;
+};
+
+#define PROXY_USER_DATA_OFFSET SPA_ROUND_UP_N(sizeof(struct bench_proxy), 16)
+
+struct bench_stream {
+	enum pw_stream_state state;
+	struct spa_hook_list listeners;
+};
+
+/** Requests are answered in the order they're made, like the real protocol does.
+  * A sync is done once the globals of a registry requested before it are announced,
+  * and before the proxies bound while handling them are */
+enum bench_message_type {
+	MESSAGE_GLOBALS,
+	MESSAGE_BIND,
+	MESSAGE_DONE,
+	MESSAGE_REMOVE,
+};
+
+struct bench_message {
+	enum bench_message_type type;
+	struct bench_proxy *proxy;
+	struct bench_core *core;
+	int seq;
+	uint32_t id;
+};
+
+struct bench_source {
+	void (*func)(void *data, uint64_t count);
+	void *data;
+	bool signaled;
+
+	struct spa_list link;
+};
+
+static struct {
+	/* Indexed by id, NULL once removed. Ids aren't reused */
+	DARRAY(struct bench_global *) globals;
+	uint32_t next_serial;
+
+	struct spa_list registries;
+	struct spa_list sources;
+
+	DARRAY(struct bench_message) messages;
+	size_t next_message;
+
+	const char *default_sink;
+	const char *default_source;
+
+	/* Only their addresses are used */
+	char thread_loop;
+	char loop;
+	char context;
+
+	uint64_t registry_events;
+	uint64_t destroyed_proxies;
+	uint64_t warnings;
+} server;
+
+static struct bench_global *get_global(uint32_t id)
+{
+	return id < server.globals.num ? server.globals.array[id] : NULL;
+}
+
+/** Takes over the props and info */
+static struct bench_global *add_global(const char *type, uint32_t version, struct pw_properties *props,
+				       struct pw_properties *info)
+{
+	struct bench_global *global = bzalloc(sizeof(struct bench_global));
+	global->id = (uint32_t)server.globals.num;
+	global->type = type;
+	global->version = version;
+	global->props = props;
+	global->info = info;
+	da_init(global->children);
+	spa_list_init(&global->proxies);
+
+	pw_properties_setf(props, PW_KEY_OBJECT_SERIAL, "%u", server.next_serial++);
+	if (info) {
+		pw_properties_update(info, &props->dict);
+	}
+
+	da_push_back(server.globals, &global);
+
+	return global;
+}
+
+static void add_child(struct bench_global *global, uint32_t child)
+{
+	da_push_back(global->children, &child);
+}
+
+static void proxy_ref(struct bench_proxy *proxy)
+{
+	proxy->refs++;
+}
+
+static void proxy_unref(struct bench_proxy *proxy)
+{
+	if (--proxy->refs) {
+		return;
+	}
+
+	pw_properties_free(proxy->create_props);
+	bfree(proxy);
+}
+
+static void announce_global(struct bench_global *global)
+{
+	struct bench_proxy *registry, *temp;
+	spa_list_for_each_safe(registry, temp, &server.registries, registry_link)
+	{
+		server.registry_events++;
+		spa_hook_list_call(&registry->object_listeners, struct pw_registry_events, global, 0, global->id,
+				   PW_PERM_RWX, global->type, global->version, &global->props->dict);
+	}
+}
+
+static void announce_children(struct bench_global *global)
+{
+	for (size_t i = 0; i < global->children.num; i++) {
+		struct bench_global *child = get_global(global->children.array[i]);
+		if (child) {
+			announce_global(child);
+		}
+	}
+}
+
+static void remove_global(uint32_t id)
+{
+	struct bench_global *global = get_global(id);
+	if (!global) {
+		return;
+	}
+
+	for (size_t i = 0; i < global->children.num; i++) {
+		remove_global(global->children.array[i]);
+	}
+
+	server.globals.array[id] = NULL;
+
+	while (!spa_list_is_empty(&global->proxies)) {
+		struct bench_proxy *proxy = spa_list_first(&global->proxies, struct bench_proxy, global_link);
+		spa_list_remove(&proxy->global_link);
+		spa_list_init(&proxy->global_link);
+
+		proxy_ref(proxy);
+		spa_hook_list_call(&proxy->listeners, struct pw_proxy_events, removed, 0);
+		proxy_unref(proxy);
+	}
+
+	struct bench_proxy *registry, *temp;
+	spa_list_for_each_safe(registry, temp, &server.registries, registry_link)
+	{
+		server.registry_events++;
+		spa_hook_list_call(&registry->object_listeners, struct pw_registry_events, global_remove, 0, id);
+	}
+
+	pw_properties_free(global->props);
+	pw_properties_free(global->info);
+	da_free(global->children);
+	bfree(global);
+}
+
+static const char *channel_names[] = {"FL", "FR", "RL", "RR", "FC", "LFE", "SL", "SR"};
+
+static void channel_name(uint32_t i, char *name, size_t size)
+{
+	if (i < SPA_N_ELEMENTS(channel_names)) {
+		snprintf(name, size, "%s", channel_names[i]);
+	} else {
+		snprintf(name, size, "AUX%u", i);
+	}
+}
+
+static struct bench_global *add_port(struct bench_global *node, const char *direction, const char *channel)
+{
+	struct pw_properties *props = pw_properties_new(PW_KEY_PORT_DIRECTION, direction, PW_KEY_AUDIO_CHANNEL,
+							channel, NULL);
+	pw_properties_setf(props, PW_KEY_NODE_ID, "%u", node->id);
+
+	struct bench_global *port = add_global(PW_TYPE_INTERFACE_Port, PW_VERSION_PORT, props, NULL);
+	add_child(node, port->id);
+
+	return port;
+}
+
+/** An adapter gets an input port per position, like a null sink */
+static void add_adapter_ports(struct bench_global *node)
+{
+	const char *position = pw_properties_get(node->props, SPA_KEY_AUDIO_POSITION);
+	if (!position) {
+		return;
+	}
+
+	const char *separators = ",[] ";
+	while (*position) {
+		size_t len = strcspn(position, separators);
+		if (len) {
+			char channel[16];
+			snprintf(channel, sizeof(channel), "%.*s", (int)len, position);
+			add_port(node, "in", channel);
+		}
+
+		position += len;
+		position += strspn(position, separators);
+	}
+}
+
+/* Links go away with either of their ports */
+static void attach_link(struct bench_global *link, const char *port_key)
+{
+	const char *port_id = pw_properties_get(link->props, port_key);
+	struct bench_global *port = port_id ? get_global(strtoul(port_id, NULL, 10)) : NULL;
+	if (port) {
+		add_child(port, link->id);
+	}
+}
+
+static struct bench_global *create_global(struct bench_proxy *proxy)
+{
+	struct pw_properties *props = pw_properties_new_dict(&proxy->create_props->dict);
+
+	if (strcmp(proxy->type, PW_TYPE_INTERFACE_Node) == 0) {
+		struct bench_global *node = add_global(PW_TYPE_INTERFACE_Node, PW_VERSION_NODE, props, NULL);
+		add_adapter_ports(node);
+		return node;
+	} else if (strcmp(proxy->type, PW_TYPE_INTERFACE_Link) == 0) {
+		struct bench_global *link = add_global(PW_TYPE_INTERFACE_Link, PW_VERSION_LINK, props, NULL);
+		attach_link(link, PW_KEY_LINK_OUTPUT_PORT);
+		attach_link(link, PW_KEY_LINK_INPUT_PORT);
+		return link;
+	}
+
+	return add_global(proxy->type, 0, props, NULL);
+}
+
+static void emit_default_metadata(struct bench_proxy *proxy, const char *key, const char *name)
+{
+	char value[256];
+	snprintf(value, sizeof(value), "{ \"name\": \"%s\" }", name);
+
+	spa_hook_list_call(&proxy->object_listeners, struct pw_metadata_events, property, 0, PW_ID_CORE, key,
+			   "Spa:String:JSON", value);
+}
+
+/** The info that follows the bound event */
+static void emit_info(struct bench_proxy *proxy, struct bench_global *global)
+{
+	struct spa_dict *props = &(global->info ? global->info : global->props)->dict;
+
+	if (strcmp(proxy->type, PW_TYPE_INTERFACE_Node) == 0) {
+		struct pw_node_info info = {.id = global->id, .change_mask = PW_NODE_CHANGE_MASK_PROPS, .props = props};
+		spa_hook_list_call(&proxy->object_listeners, struct pw_node_events, info, 0, &info);
+	} else if (strcmp(proxy->type, PW_TYPE_INTERFACE_Client) == 0) {
+		struct pw_client_info info = {.id = global->id, .change_mask = PW_CLIENT_CHANGE_MASK_PROPS, .props = props};
+		spa_hook_list_call(&proxy->object_listeners, struct pw_client_events, info, 0, &info);
+	} else if (strcmp(proxy->type, PW_TYPE_INTERFACE_Device) == 0) {
+		struct pw_device_info info = {.id = global->id, .change_mask = PW_DEVICE_CHANGE_MASK_PROPS, .props = props};
+		spa_hook_list_call(&proxy->object_listeners, struct pw_device_events, info, 0, &info);
+	} else if (strcmp(proxy->type, PW_TYPE_INTERFACE_Link) == 0) {
+		struct pw_link_info info = {
+			.id = global->id,
+			.change_mask = PW_LINK_CHANGE_MASK_STATE,
+			.state = PW_LINK_STATE_ACTIVE,
+		};
+		spa_hook_list_call(&proxy->object_listeners, struct pw_link_events, info, 0, &info);
+	} else if (strcmp(proxy->type, PW_TYPE_INTERFACE_Metadata) == 0) {
+		emit_default_metadata(proxy, "default.audio.sink", server.default_sink);
+		emit_default_metadata(proxy, "default.audio.source", server.default_source);
+	}
+}
+
+static void bind_pending(struct bench_proxy *proxy)
+{
+	struct bench_global *created = NULL;
+	if (proxy->create_props) {
+		created = create_global(proxy);
+		proxy->id = created->id;
+		spa_list_append(&created->proxies, &proxy->global_link);
+	}
+
+	struct bench_global *global = get_global(proxy->id);
+	if (!global) {
+		/* Bound to a global that's already gone, the removed event has nothing to reach */
+		return;
+	}
+
+	spa_hook_list_call(&proxy->listeners, struct pw_proxy_events, bound, 0, global->id);
+	emit_info(proxy, global);
+
+	if (created && get_global(created->id)) {
+		announce_global(created);
+		announce_children(created);
+	}
+}
+
+static void replay_globals(struct bench_proxy *registry)
+{
+	for (size_t i = 0; i < server.globals.num; i++) {
+		struct bench_global *global = server.globals.array[i];
+		if (!global) {
+			continue;
+		}
+
+		server.registry_events++;
+		spa_hook_list_call(&registry->object_listeners, struct pw_registry_events, global, 0, global->id,
+				   PW_PERM_RWX, global->type, global->version, &global->props->dict);
+	}
+
+	/* Told about new globals from now on */
+	spa_list_append(&server.registries, &registry->registry_link);
+}
+
+static void queue_message(const struct bench_message *message)
+{
+	if (message->proxy) {
+		proxy_ref(message->proxy);
+	}
+	da_push_back(server.messages, message);
+}
+
+static void handle_message(struct bench_message *message)
+{
+	switch (message->type) {
+	case MESSAGE_GLOBALS:
+		if (!message->proxy->destroyed) {
+			replay_globals(message->proxy);
+		}
+		break;
+	case MESSAGE_BIND:
+		if (!message->proxy->destroyed) {
+			bind_pending(message->proxy);
+		}
+		break;
+	case MESSAGE_DONE:
+		if (message->core) {
+			spa_hook_list_call(&message->core->listeners, struct pw_core_events, done, 0, PW_ID_CORE,
+					   message->seq);
+		}
+		break;
+	case MESSAGE_REMOVE:
+		remove_global(message->id);
+		break;
+	}
+
+	if (message->proxy) {
+		proxy_unref(message->proxy);
+	}
+}
+
+static bool dispatch_once(void)
+{
+	if (server.next_message < server.messages.num) {
+		/* Handling it may queue more and move the array */
+		struct bench_message message = server.messages.array[server.next_message++];
+		if (server.next_message == server.messages.num) {
+			server.next_message = 0;
+			server.messages.num = 0;
+		}
+
+		handle_message(&message);
+		return true;
+	}
+
+	/* Callbacks may destroy sources, start over after each */
+	struct bench_source *source;
+	spa_list_for_each(source, &server.sources, link)
+	{
+		if (source->signaled) {
+			source->signaled = false;
+			source->func(source->data, 1);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void dispatch(void)
+{
+	while (dispatch_once()) {
+	}
+}
+/* ------------------------------------------------- */
+
+/* Stub PipeWire layer */
+struct pw_thread_loop *bench_thread_loop_new(const char *name, const struct spa_dict *props)
+{
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(props);
+	return (struct pw_thread_loop *)&server.thread_loop;
+}
+
+void bench_thread_loop_destroy(struct pw_thread_loop *loop)
+{
+	UNUSED_PARAMETER(loop);
+}
+
+int bench_thread_loop_start(struct pw_thread_loop *loop)
+{
+	UNUSED_PARAMETER(loop);
+	return 0;
+}
+
+void bench_thread_loop_stop(struct pw_thread_loop *loop)
+{
+	UNUSED_PARAMETER(loop);
+}
+
+void bench_thread_loop_lock(struct pw_thread_loop *loop)
+{
+	UNUSED_PARAMETER(loop);
+}
+
+void bench_thread_loop_unlock(struct pw_thread_loop *loop)
+{
+	UNUSED_PARAMETER(loop);
+}
+
+void bench_thread_loop_signal(struct pw_thread_loop *loop, bool wait_for_accept)
+{
+	UNUSED_PARAMETER(loop);
+	UNUSED_PARAMETER(wait_for_accept);
+}
+
+/* Whatever is waited for has happened once everything is dispatched */
+int bench_thread_loop_timed_wait(struct pw_thread_loop *loop, int wait_max_sec)
+{
+	UNUSED_PARAMETER(loop);
+	UNUSED_PARAMETER(wait_max_sec);
+
+	dispatch();
+	return 0;
+}
+
+struct pw_loop *bench_thread_loop_get_loop(struct pw_thread_loop *loop)
+{
+	UNUSED_PARAMETER(loop);
+	return (struct pw_loop *)&server.loop;
+}
+
+static struct spa_source *add_source(void (*func)(void *data, uint64_t count), void *data)
+{
+	struct bench_source *source = bzalloc(sizeof(struct bench_source));
+	source->func = func;
+	source->data = data;
+	spa_list_append(&server.sources, &source->link);
+
+	return (struct spa_source *)source;
+}
+
+struct spa_source *bench_loop_add_event(struct pw_loop *loop, spa_source_event_func_t func, void *data)
+{
+	UNUSED_PARAMETER(loop);
+	return add_source(func, data);
+}
+
+struct spa_source *bench_loop_add_timer(struct pw_loop *loop, spa_source_timer_func_t func, void *data)
+{
+	UNUSED_PARAMETER(loop);
+	return add_source(func, data);
+}
+
+int bench_loop_signal_event(struct pw_loop *loop, struct spa_source *source)
+{
+	UNUSED_PARAMETER(loop);
+
+	((struct bench_source *)source)->signaled = true;
+	return 0;
+}
+
+int bench_loop_update_timer(struct pw_loop *loop, struct spa_source *source, struct timespec *value,
+			    struct timespec *interval, bool absolute)
+{
+	UNUSED_PARAMETER(loop);
+	UNUSED_PARAMETER(source);
+	UNUSED_PARAMETER(value);
+	UNUSED_PARAMETER(interval);
+	UNUSED_PARAMETER(absolute);
+	return 0;
+}
+
+void bench_loop_destroy_source(struct pw_loop *loop, struct spa_source *object)
+{
+	UNUSED_PARAMETER(loop);
+
+	struct bench_source *source = (struct bench_source *)object;
+	spa_list_remove(&source->link);
+	bfree(source);
+}
+
+struct pw_context *bench_context_new(struct pw_loop *main_loop, struct pw_properties *props, size_t user_data_size)
+{
+	UNUSED_PARAMETER(main_loop);
+	UNUSED_PARAMETER(user_data_size);
+
+	pw_properties_free(props);
+	return (struct pw_context *)&server.context;
+}
+
+void bench_context_destroy(struct pw_context *context)
+{
+	UNUSED_PARAMETER(context);
+}
+
+struct pw_core *bench_context_connect(struct pw_context *context, struct pw_properties *props, size_t user_data_size)
+{
+	UNUSED_PARAMETER(context);
+	UNUSED_PARAMETER(user_data_size);
+
+	pw_properties_free(props);
+
+	struct bench_core *core = bzalloc(sizeof(struct bench_core));
+	spa_hook_list_init(&core->listeners);
+	spa_list_init(&core->proxies);
+
+	return (struct pw_core *)core;
+}
+
+struct pw_loop *bench_context_get_main_loop(struct pw_context *context)
+{
+	UNUSED_PARAMETER(context);
+	return (struct pw_loop *)&server.loop;
+}
+
+struct pw_context *bench_core_get_context(struct pw_core *core)
+{
+	UNUSED_PARAMETER(core);
+	return (struct pw_context *)&server.context;
+}
+
+int bench_core_add_listener(struct pw_core *object, struct spa_hook *listener, const struct pw_core_events *events,
+			    void *data)
+{
+	struct bench_core *core = (struct bench_core *)object;
+	spa_hook_list_append(&core->listeners, listener, events, data);
+	return 0;
+}
+
+static struct bench_proxy *proxy_new(struct bench_core *core, const char *type, size_t user_data_size)
+{
+	struct bench_proxy *proxy = bzalloc(PROXY_USER_DATA_OFFSET + user_data_size);
+	proxy->type = type;
+	proxy->id = SPA_ID_INVALID;
+	proxy->refs = 1;
+	proxy->core = core;
+
+	spa_list_append(&core->proxies, &proxy->core_link);
+	spa_list_init(&proxy->global_link);
+	spa_list_init(&proxy->registry_link);
+
+	spa_hook_list_init(&proxy->listeners);
+	spa_hook_list_init(&proxy->object_listeners);
+
+	return proxy;
+}
+
+struct pw_registry *bench_core_get_registry(struct pw_core *object, uint32_t version, size_t user_data_size)
+{
+	UNUSED_PARAMETER(version);
+
+	return (struct pw_registry *)proxy_new((struct bench_core *)object, PW_TYPE_INTERFACE_Registry,
+					       user_data_size);
+}
+
+void *bench_core_create_object(struct pw_core *object, const char *factory_name, const char *type, uint32_t version,
+			       const struct spa_dict *props, size_t user_data_size)
+{
+	UNUSED_PARAMETER(factory_name);
+	UNUSED_PARAMETER(version);
+
+	struct bench_proxy *proxy = proxy_new((struct bench_core *)object, type, user_data_size);
+	proxy->create_props = pw_properties_new_dict(props);
+
+	const char *linger = spa_dict_lookup(props, PW_KEY_OBJECT_LINGER);
+	proxy->lingers = linger && strcmp(linger, "true") == 0;
+
+	queue_message(&(struct bench_message){.type = MESSAGE_BIND, .proxy = proxy});
+
+	return proxy;
+}
+
+int bench_core_sync(struct pw_core *object, uint32_t id, int seq)
+{
+	UNUSED_PARAMETER(id);
+	UNUSED_PARAMETER(seq);
+
+	struct bench_core *core = (struct bench_core *)object;
+
+	int sync_seq = ++core->seq;
+	queue_message(&(struct bench_message){.type = MESSAGE_DONE, .core = core, .seq = sync_seq});
+
+	return sync_seq;
+}
+
+/* Like the real one, the proxies that are left are destroyed along with the core */
+int bench_core_disconnect(struct pw_core *object)
+{
+	struct bench_core *core = (struct bench_core *)object;
+
+	while (!spa_list_is_empty(&core->proxies)) {
+		pw_proxy_destroy((struct pw_proxy *)spa_list_first(&core->proxies, struct bench_proxy, core_link));
+	}
+
+	for (size_t i = server.next_message; i < server.messages.num; i++) {
+		if (server.messages.array[i].core == core) {
+			server.messages.array[i].core = NULL;
+		}
+	}
+
+	spa_hook_list_clean(&core->listeners);
+	bfree(core);
+
+	return 0;
+}
+
+int bench_registry_add_listener(struct pw_registry *object, struct spa_hook *listener,
+				const struct pw_registry_events *events, void *data)
+{
+	struct bench_proxy *registry = (struct bench_proxy *)object;
+	spa_hook_list_append(&registry->object_listeners, listener, events, data);
+
+	/* The existing globals are announced to the new listener */
+	queue_message(&(struct bench_message){.type = MESSAGE_GLOBALS, .proxy = registry});
+
+	return 0;
+}
+
+void *bench_registry_bind(struct pw_registry *object, uint32_t id, const char *type, uint32_t version,
+			  size_t user_data_size)
+{
+	UNUSED_PARAMETER(version);
+
+	struct bench_proxy *registry = (struct bench_proxy *)object;
+	struct bench_proxy *proxy = proxy_new(registry->core, type, user_data_size);
+	proxy->id = id;
+
+	struct bench_global *global = get_global(id);
+	if (global) {
+		spa_list_append(&global->proxies, &proxy->global_link);
+	}
+	queue_message(&(struct bench_message){.type = MESSAGE_BIND, .proxy = proxy});
+
+	return proxy;
+}
+
+int bench_registry_destroy(struct pw_registry *registry, uint32_t id)
+{
+	UNUSED_PARAMETER(registry);
+
+	queue_message(&(struct bench_message){.type = MESSAGE_REMOVE, .id = id});
+	return 0;
+}
+
+void bench_proxy_add_listener(struct pw_proxy *object, struct spa_hook *listener, const struct pw_proxy_events *events,
+			      void *data)
+{
+	struct bench_proxy *proxy = (struct bench_proxy *)object;
+	spa_hook_list_append(&proxy->listeners, listener, events, data);
+}
+
+void bench_proxy_add_object_listener(struct pw_proxy *object, struct spa_hook *listener, const void *funcs, void *data)
+{
+	struct bench_proxy *proxy = (struct bench_proxy *)object;
+	spa_hook_list_append(&proxy->object_listeners, listener, funcs, data);
+}
+
+void *bench_proxy_get_user_data(struct pw_proxy *proxy)
+{
+	return SPA_PTROFF(proxy, PROXY_USER_DATA_OFFSET, void);
+}
+
+void bench_proxy_destroy(struct pw_proxy *object)
+{
+	struct bench_proxy *proxy = (struct bench_proxy *)object;
+
+	proxy_ref(proxy);
+
+	spa_hook_list_call(&proxy->listeners, struct pw_proxy_events, destroy, 0);
+
+	proxy->destroyed = true;
+	spa_list_remove(&proxy->core_link);
+	spa_list_remove(&proxy->global_link);
+	spa_list_remove(&proxy->registry_link);
+	spa_list_init(&proxy->global_link);
+	spa_list_init(&proxy->registry_link);
+
+	spa_hook_list_clean(&proxy->listeners);
+	spa_hook_list_clean(&proxy->object_listeners);
+
+	if (proxy->create_props && !proxy->lingers && proxy->id != SPA_ID_INVALID) {
+		queue_message(&(struct bench_message){.type = MESSAGE_REMOVE, .id = proxy->id});
+	}
+
+	server.destroyed_proxies++;
+
+	proxy_unref(proxy);
+	proxy_unref(proxy);
+}
+
+/* No params, the layout comes with the info */
+int bench_node_subscribe_params(struct pw_node *node, uint32_t *ids, uint32_t n_ids)
+{
+	UNUSED_PARAMETER(node);
+	UNUSED_PARAMETER(ids);
+	UNUSED_PARAMETER(n_ids);
+	return 0;
+}
+
+struct pw_stream *bench_stream_new(struct pw_core *core, const char *name, struct pw_properties *props)
+{
+	UNUSED_PARAMETER(core);
+	UNUSED_PARAMETER(name);
+
+	pw_properties_free(props);
+
+	struct bench_stream *stream = bzalloc(sizeof(struct bench_stream));
+	stream->state = PW_STREAM_STATE_UNCONNECTED;
+	spa_hook_list_init(&stream->listeners);
+
+	return (struct pw_stream *)stream;
+}
+
+void bench_stream_destroy(struct pw_stream *object)
+{
+	struct bench_stream *stream = (struct bench_stream *)object;
+
+	spa_hook_list_call(&stream->listeners, struct pw_stream_events, destroy, 0);
+	spa_hook_list_clean(&stream->listeners);
+
+	bfree(stream);
+}
+
+void bench_stream_add_listener(struct pw_stream *object, struct spa_hook *listener,
+			       const struct pw_stream_events *events, void *data)
+{
+	struct bench_stream *stream = (struct bench_stream *)object;
+	spa_hook_list_append(&stream->listeners, listener, events, data);
+}
+
+int bench_stream_connect(struct pw_stream *object, enum pw_direction direction, uint32_t target_id,
+			 enum pw_stream_flags flags, const struct spa_pod **params, uint32_t n_params)
+{
+	UNUSED_PARAMETER(direction);
+	UNUSED_PARAMETER(target_id);
+	UNUSED_PARAMETER(flags);
+	UNUSED_PARAMETER(params);
+	UNUSED_PARAMETER(n_params);
+
+	((struct bench_stream *)object)->state = PW_STREAM_STATE_CONNECTING;
+	return 0;
+}
+
+int bench_stream_disconnect(struct pw_stream *object)
+{
+	((struct bench_stream *)object)->state = PW_STREAM_STATE_UNCONNECTED;
+	return 0;
+}
+
+enum pw_stream_state bench_stream_get_state(struct pw_stream *object, const char **error)
+{
+	if (error) {
+		*error = NULL;
+	}
+	return ((struct bench_stream *)object)->state;
+}
+
+int bench_stream_set_active(struct pw_stream *stream, bool active)
+{
+	UNUSED_PARAMETER(stream);
+	UNUSED_PARAMETER(active);
+	return 0;
+}
+
+int bench_stream_update_properties(struct pw_stream *stream, const struct spa_dict *dict)
+{
+	UNUSED_PARAMETER(stream);
+	UNUSED_PARAMETER(dict);
+	return 0;
+}
+/* ------------------------------------------------- */
+
+/* Stub libobs */
+static DARRAY(struct obs_source_info) source_infos;
+static char source_object;
+
+void bench_register_source_s(const struct obs_source_info *info, size_t size)
+{
+	struct obs_source_info *copy = da_push_back_new(source_infos);
+	memcpy(copy, info, SPA_MIN(size, sizeof(struct obs_source_info)));
+}
+
+const char *bench_source_get_name(const obs_source_t *source)
+{
+	UNUSED_PARAMETER(source);
+	return "Registry bench";
+}
+
+obs_data_t *bench_source_get_settings(const obs_source_t *source)
+{
+	UNUSED_PARAMETER(source);
+	return obs_data_create();
+}
+
+bool bench_source_active(const obs_source_t *source)
+{
+	UNUSED_PARAMETER(source);
+	return true;
+}
+
+void bench_source_update(obs_source_t *source, obs_data_t *settings)
+{
+	UNUSED_PARAMETER(source);
+	UNUSED_PARAMETER(settings);
+}
+
+bool bench_get_audio_info(struct obs_audio_info *oai)
+{
+	memset(oai, 0, sizeof(*oai));
+	oai->samples_per_sec = 48000;
+	oai->speakers = SPEAKERS_STEREO;
+	return true;
+}
+
+const char *obs_module_text(const char *lookup_string)
+{
+	return lookup_string;
+}
+
+static void log_handler(int level, const char *format, va_list args, void *param)
+{
+	UNUSED_PARAMETER(param);
+
+	if (level == LOG_WARNING) {
+		server.warnings++;
+	} else if (level == LOG_ERROR) {
+		vfprintf(stderr, format, args);
+		fputc('\n', stderr);
+	}
+}
+/* ------------------------------------------------- */
+
+/* Synthetic graph */
+struct bench_scale {
+	uint32_t nodes;
+	uint32_t ports;
+	uint32_t clients;
+};
+
+static struct {
+	DARRAY(uint32_t) app_streams;
+	uint32_t first_client;
+	uint32_t clients;
+	uint32_t ports_per_node;
+	uint32_t generation;
+} graph;
+
+static void layout_props(struct pw_properties *info, uint32_t channels)
+{
+	struct dstr position;
+	dstr_init(&position);
+
+	for (uint32_t i = 0; i < channels; i++) {
+		char name[16];
+		channel_name(i, name, sizeof(name));
+
+		if (i) {
+			dstr_cat_ch(&position, ',');
+		}
+		dstr_cat(&position, name);
+	}
+
+	pw_properties_setf(info, PW_KEY_AUDIO_CHANNELS, "%u", channels);
+	pw_properties_set(info, SPA_KEY_AUDIO_POSITION, position.array);
+
+	dstr_free(&position);
+}
+
+static void add_node_ports(struct bench_global *node, const char *direction)
+{
+	for (uint32_t i = 0; i < graph.ports_per_node; i++) {
+		char name[16];
+		channel_name(i, name, sizeof(name));
+		add_port(node, direction, name);
+	}
+}
+
+static struct bench_global *add_app_stream(uint32_t index)
+{
+	uint32_t client = index % graph.clients;
+
+	struct pw_properties *props = pw_properties_new(PW_KEY_MEDIA_CLASS, "Stream/Output/Audio", NULL);
+	pw_properties_setf(props, PW_KEY_NODE_NAME, "app%u.stream%u.%u", client, index, graph.generation);
+	pw_properties_setf(props, PW_KEY_APP_NAME, "App %u", client);
+	pw_properties_setf(props, PW_KEY_CLIENT_ID, "%u", graph.first_client + client);
+
+	struct pw_properties *info = pw_properties_new(NULL, NULL);
+	pw_properties_setf(info, PW_KEY_APP_PROCESS_BINARY, "app%u", client);
+	layout_props(info, graph.ports_per_node);
+
+	struct bench_global *node = add_global(PW_TYPE_INTERFACE_Node, PW_VERSION_NODE, props, info);
+	add_node_ports(node, "out");
+
+	return node;
+}
+
+/** Identified by its device, which has to be bound for the bus path and serial */
+static void add_device_node(uint32_t index, bool sink)
+{
+	struct pw_properties *device_props = pw_properties_new(PW_KEY_MEDIA_CLASS, "Audio/Device", NULL);
+	pw_properties_setf(device_props, PW_KEY_DEVICE_BUS_PATH, "pci-0000:%02x:00.%u", index / 8, index % 8);
+	pw_properties_setf(device_props, PW_KEY_DEVICE_SERIAL, "bench-%s-%u", sink ? "sink" : "source", index);
+	struct bench_global *device = add_global(PW_TYPE_INTERFACE_Device, PW_VERSION_DEVICE, device_props, NULL);
+
+	struct pw_properties *props =
+		pw_properties_new(PW_KEY_MEDIA_CLASS, sink ? "Audio/Sink" : "Audio/Source", NULL);
+	pw_properties_setf(props, PW_KEY_NODE_NAME, "%s.%u", sink ? "alsa_output" : "alsa_input", index);
+	pw_properties_setf(props, PW_KEY_NODE_DESCRIPTION, "%s %u", sink ? "Output" : "Input", index);
+	pw_properties_setf(props, PW_KEY_DEVICE_ID, "%u", device->id);
+
+	struct pw_properties *info = pw_properties_new(NULL, NULL);
+	layout_props(info, graph.ports_per_node);
+
+	struct bench_global *node = add_global(PW_TYPE_INTERFACE_Node, PW_VERSION_NODE, props, info);
+	add_node_ports(node, sink ? "in" : "out");
+}
+
+static void build_graph(const struct bench_scale *scale)
+{
+	da_init(server.globals);
+	da_init(server.messages);
+	server.next_message = 0;
+	spa_list_init(&server.registries);
+	spa_list_init(&server.sources);
+	server.next_serial = 1;
+
+	/* The core */
+	struct bench_global *none = NULL;
+	da_push_back(server.globals, &none);
+
+	graph.clients = SPA_MAX(scale->clients, 1u);
+	graph.ports_per_node = SPA_MAX(scale->ports / SPA_MAX(scale->nodes, 1u), 1u);
+	graph.generation = 0;
+	da_init(graph.app_streams);
+
+	graph.first_client = (uint32_t)server.globals.num;
+	for (uint32_t i = 0; i < graph.clients; i++) {
+		struct pw_properties *props = pw_properties_new(NULL, NULL);
+		pw_properties_setf(props, PW_KEY_APP_NAME, "App %u", i);
+
+		struct pw_properties *info = pw_properties_new(NULL, NULL);
+		pw_properties_setf(info, PW_KEY_APP_PROCESS_BINARY, "app%u", i);
+
+		add_global(PW_TYPE_INTERFACE_Client, PW_VERSION_CLIENT, props, info);
+	}
+
+	/* An eighth of the nodes are sinks and another eighth sources, the rest are app streams */
+	uint32_t devices = SPA_MAX(scale->nodes / 8, 1u);
+	for (uint32_t i = 0; i < devices; i++) {
+		add_device_node(i, true);
+		add_device_node(i, false);
+	}
+
+	uint32_t streams = scale->nodes > devices * 2 ? scale->nodes - devices * 2 : 1;
+	for (uint32_t i = 0; i < streams; i++) {
+		struct bench_global *node = add_app_stream(i);
+		da_push_back(graph.app_streams, &node->id);
+	}
+
+	server.default_sink = "alsa_output.0";
+	server.default_source = "alsa_input.0";
+	add_global(PW_TYPE_INTERFACE_Metadata, PW_VERSION_METADATA,
+		   pw_properties_new(PW_KEY_METADATA_NAME, "default", NULL), NULL);
+}
+
+static void free_graph(void)
+{
+	for (size_t i = 0; i < server.globals.num; i++) {
+		remove_global((uint32_t)i);
+	}
+	da_free(server.globals);
+	da_free(server.messages);
+	da_free(graph.app_streams);
+}
+
+/** Replaces an app stream by a new one of the same app, like an app recreating its stream */
+static void churn_app_stream(size_t i)
+{
+	remove_global(graph.app_streams.array[i]);
+
+	graph.generation++;
+	struct bench_global *node = add_app_stream((uint32_t)i);
+	graph.app_streams.array[i] = node->id;
+
+	announce_global(node);
+	announce_children(node);
+}
+/* ------------------------------------------------- */
+
+/* Measurement */
+struct phase {
+	uint64_t cpu_ns;
+	uint64_t allocs;
+	int64_t live;
+
+	uint64_t resumed_cpu_ns;
+	uint64_t resumed_allocs;
+};
+
+static uint64_t cpu_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * SPA_NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static void phase_begin(struct phase *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->live = heap.live;
+	heap.peak = heap.live;
+}
+
+/* Only what is between resume and suspend is measured, the graph changes in between aren't */
+static void phase_resume(struct phase *p)
+{
+	p->resumed_allocs = heap.calls;
+	p->resumed_cpu_ns = cpu_time_ns();
+}
+
+static void phase_suspend(struct phase *p)
+{
+	p->cpu_ns += cpu_time_ns() - p->resumed_cpu_ns;
+	p->allocs += heap.calls - p->resumed_allocs;
+}
+
+static void phase_report(const struct phase *p, const struct bench_scale *scale, const char *source,
+			 const char *phase, const char *unit, uint64_t events)
+{
+	double n = (double)SPA_MAX(events, (uint64_t)1);
+
+	printf("%5u/%-5u/%-4u %-7s %-9s %8" PRIu64 " %-8s %12.1f %12.2f %12.1f %12.1f\n", scale->nodes, scale->ports,
+	       scale->clients, source, phase, events, unit, (double)p->cpu_ns / n, (double)p->allocs / n,
+	       (double)(heap.peak - p->live) / 1024.0, (double)(heap.live - p->live) / n);
+}
+
+static const struct obs_source_info *find_source_info(const char *id)
+{
+	for (size_t i = 0; i < source_infos.num; i++) {
+		if (strcmp(source_infos.array[i].id, id) == 0) {
+			return &source_infos.array[i];
+		}
+	}
+
+	fprintf(stderr, "No source %s registered\n", id);
+	exit(EXIT_FAILURE);
+}
+
+static obs_data_t *make_settings(const struct obs_source_info *info, bool app)
+{
+	obs_data_t *settings = obs_data_create();
+	info->get_defaults(settings);
+
+	if (app) {
+		/* Spread over the clients, each with several streams */
+		obs_data_set_int(settings, "CaptureMode", BENCH_CAPTURE_MODE_MULTIPLE);
+
+		obs_data_array_t *apps = obs_data_array_create();
+		uint32_t step = SPA_MAX(graph.clients / BENCH_SELECTED_APPS, 1u);
+		for (uint32_t i = 0; i < graph.clients && i / step < BENCH_SELECTED_APPS; i += step) {
+			char name[32];
+			snprintf(name, sizeof(name), "App %u", i);
+
+			obs_data_t *item = obs_data_create();
+			obs_data_set_string(item, "value", name);
+			obs_data_array_push_back(apps, item);
+			obs_data_release(item);
+		}
+		obs_data_set_array(settings, "apps", apps);
+		obs_data_array_release(apps);
+	}
+
+	return settings;
+}
+
+static void run(const struct bench_scale *scale, const char *source_name, const char *source_id, bool app)
+{
+	build_graph(scale);
+
+	const struct obs_source_info *info = find_source_info(source_id);
+	obs_data_t *settings = make_settings(info, app);
+
+	struct phase p;
+	uint64_t events;
+
+	/* The registry announces the whole graph to the new source */
+	phase_begin(&p);
+	events = server.registry_events;
+	phase_resume(&p);
+	void *data = info->create(settings, (obs_source_t *)&source_object);
+	dispatch();
+	phase_suspend(&p);
+	if (!data) {
+		fprintf(stderr, "Creating %s failed\n", source_name);
+		exit(EXIT_FAILURE);
+	}
+	phase_report(&p, scale, source_name, "sync", "global", server.registry_events - events);
+
+	/* A quarter of the app streams are replaced, one at a time */
+	phase_begin(&p);
+	events = server.registry_events;
+	size_t churn = SPA_MAX(graph.app_streams.num / 4, (size_t)1);
+	for (size_t i = 0; i < churn && i < graph.app_streams.num; i++) {
+		phase_resume(&p);
+		churn_app_stream(i);
+		dispatch();
+		phase_suspend(&p);
+	}
+	phase_report(&p, scale, source_name, "churn", "global", server.registry_events - events);
+
+	/* What opening the properties dialog does */
+	phase_begin(&p);
+	phase_resume(&p);
+	for (uint32_t i = 0; i < BENCH_PROPERTIES_CALLS; i++) {
+		obs_properties_t *props = info->get_properties(data);
+		obs_properties_apply_settings(props, settings);
+		obs_properties_destroy(props);
+	}
+	phase_suspend(&p);
+	phase_report(&p, scale, source_name, "props", "call", BENCH_PROPERTIES_CALLS);
+
+	phase_begin(&p);
+	events = server.destroyed_proxies;
+	phase_resume(&p);
+	info->destroy(data);
+	dispatch();
+	phase_suspend(&p);
+	phase_report(&p, scale, source_name, "teardown", "proxy", server.destroyed_proxies - events);
+
+	obs_data_release(settings);
+	free_graph();
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_scale full = {BENCH_NODES, BENCH_PORTS, BENCH_CLIENTS};
+	if (argc == 4) {
+		full.nodes = strtoul(argv[1], NULL, 10);
+		full.ports = strtoul(argv[2], NULL, 10);
+		full.clients = strtoul(argv[3], NULL, 10);
+	} else if (argc != 1) {
+		fprintf(stderr, "Usage: %s [nodes ports clients]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	base_set_log_handler(log_handler, NULL);
+	pw_init(NULL, NULL);
+
+	da_init(source_infos);
+	pipewire_audio_capture_load();
+	pipewire_audio_capture_app_load();
+
+	printf("%-16s %-7s %-9s %8s %-8s %12s %12s %12s %12s\n", "nodes/ports/cl", "source", "phase", "events", "per",
+	       "cpu ns/ev", "allocs/ev", "peak KiB", "retained B/ev");
+
+	/* Per event costs that grow along with the graph are what to look for */
+	for (uint32_t divisor = 4; divisor >= 1; divisor /= 2) {
+		struct bench_scale scale = {
+			SPA_MAX(full.nodes / divisor, 1u),
+			SPA_MAX(full.ports / divisor, 1u),
+			SPA_MAX(full.clients / divisor, 1u),
+		};
+
+		run(&scale, "app", "pipewire_audio_application_capture", true);
+		run(&scale, "output", "pipewire_audio_output_capture", false);
+		run(&scale, "input", "pipewire_audio_input_capture", false);
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("max RSS %ld KiB, %" PRIu64 " warnings logged\n", usage.ru_maxrss, server.warnings);
+
+	da_free(source_infos);
+	pw_deinit();
+
+	return 0;
+}
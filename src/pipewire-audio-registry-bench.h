@@ -0,0 +1,194 @@
+/* pipewire-audio-registry-bench.h
+ *
+ * Copyright 2022-2026 Dimitris Papaioannou <dimtpap@protonmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/** Stub PipeWire layer of pipewire-audio-registry-bench, force included ahead of the plugin's sources.
+  * Everything the sources include is included first, so that the renames below only apply to the calls
+  * they make, whether PipeWire implements them as functions, inline functions or macros.
+  * The stubs are in pipewire-audio-registry-bench.c */
+
+#pragma once
+
+#include "pipewire-audio.h"
+
+#include <util/dstr.h>
+#include <util/platform.h>
+
+#include <pipewire/version.h>
+#include <spa/debug/types.h>
+#include <spa/param/latency-utils.h>
+#include <spa/utils/json.h>
+
+#undef pw_thread_loop_new
+#define pw_thread_loop_new bench_thread_loop_new
+#undef pw_thread_loop_destroy
+#define pw_thread_loop_destroy bench_thread_loop_destroy
+#undef pw_thread_loop_start
+#define pw_thread_loop_start bench_thread_loop_start
+#undef pw_thread_loop_stop
+#define pw_thread_loop_stop bench_thread_loop_stop
+#undef pw_thread_loop_lock
+#define pw_thread_loop_lock bench_thread_loop_lock
+#undef pw_thread_loop_unlock
+#define pw_thread_loop_unlock bench_thread_loop_unlock
+#undef pw_thread_loop_signal
+#define pw_thread_loop_signal bench_thread_loop_signal
+#undef pw_thread_loop_timed_wait
+#define pw_thread_loop_timed_wait bench_thread_loop_timed_wait
+#undef pw_thread_loop_get_loop
+#define pw_thread_loop_get_loop bench_thread_loop_get_loop
+
+#undef pw_loop_add_event
+#define pw_loop_add_event bench_loop_add_event
+#undef pw_loop_add_timer
+#define pw_loop_add_timer bench_loop_add_timer
+#undef pw_loop_signal_event
+#define pw_loop_signal_event bench_loop_signal_event
+#undef pw_loop_update_timer
+#define pw_loop_update_timer bench_loop_update_timer
+#undef pw_loop_destroy_source
+#define pw_loop_destroy_source bench_loop_destroy_source
+
+#undef pw_context_new
+#define pw_context_new bench_context_new
+#undef pw_context_destroy
+#define pw_context_destroy bench_context_destroy
+#undef pw_context_connect
+#define pw_context_connect bench_context_connect
+#undef pw_context_get_main_loop
+#define pw_context_get_main_loop bench_context_get_main_loop
+
+#undef pw_core_get_context
+#define pw_core_get_context bench_core_get_context
+#undef pw_core_add_listener
+#define pw_core_add_listener bench_core_add_listener
+#undef pw_core_get_registry
+#define pw_core_get_registry bench_core_get_registry
+#undef pw_core_create_object
+#define pw_core_create_object bench_core_create_object
+#undef pw_core_sync
+#define pw_core_sync bench_core_sync
+#undef pw_core_disconnect
+#define pw_core_disconnect bench_core_disconnect
+
+#undef pw_registry_add_listener
+#define pw_registry_add_listener bench_registry_add_listener
+#undef pw_registry_bind
+#define pw_registry_bind bench_registry_bind
+#undef pw_registry_destroy
+#define pw_registry_destroy bench_registry_destroy
+
+#undef pw_proxy_add_listener
+#define pw_proxy_add_listener bench_proxy_add_listener
+#undef pw_proxy_add_object_listener
+#define pw_proxy_add_object_listener bench_proxy_add_object_listener
+#undef pw_proxy_get_user_data
+#define pw_proxy_get_user_data bench_proxy_get_user_data
+#undef pw_proxy_destroy
+#define pw_proxy_destroy bench_proxy_destroy
+
+#undef pw_node_subscribe_params
+#define pw_node_subscribe_params bench_node_subscribe_params
+
+#undef pw_stream_new
+#define pw_stream_new bench_stream_new
+#undef pw_stream_destroy
+#define pw_stream_destroy bench_stream_destroy
+#undef pw_stream_add_listener
+#define pw_stream_add_listener bench_stream_add_listener
+#undef pw_stream_connect
+#define pw_stream_connect bench_stream_connect
+#undef pw_stream_disconnect
+#define pw_stream_disconnect bench_stream_disconnect
+#undef pw_stream_get_state
+#define pw_stream_get_state bench_stream_get_state
+#undef pw_stream_set_active
+#define pw_stream_set_active bench_stream_set_active
+#undef pw_stream_update_properties
+#define pw_stream_update_properties bench_stream_update_properties
+
+#define obs_register_source_s bench_register_source_s
+#define obs_source_get_name bench_source_get_name
+#define obs_source_get_settings bench_source_get_settings
+#define obs_source_active bench_source_active
+#define obs_source_update bench_source_update
+#define obs_get_audio_info bench_get_audio_info
+
+struct pw_thread_loop *bench_thread_loop_new(const char *name, const struct spa_dict *props);
+void bench_thread_loop_destroy(struct pw_thread_loop *loop);
+int bench_thread_loop_start(struct pw_thread_loop *loop);
+void bench_thread_loop_stop(struct pw_thread_loop *loop);
+void bench_thread_loop_lock(struct pw_thread_loop *loop);
+void bench_thread_loop_unlock(struct pw_thread_loop *loop);
+void bench_thread_loop_signal(struct pw_thread_loop *loop, bool wait_for_accept);
+int bench_thread_loop_timed_wait(struct pw_thread_loop *loop, int wait_max_sec);
+struct pw_loop *bench_thread_loop_get_loop(struct pw_thread_loop *loop);
+
+struct spa_source *bench_loop_add_event(struct pw_loop *loop, spa_source_event_func_t func, void *data);
+struct spa_source *bench_loop_add_timer(struct pw_loop *loop, spa_source_timer_func_t func, void *data);
+int bench_loop_signal_event(struct pw_loop *loop, struct spa_source *source);
+int bench_loop_update_timer(struct pw_loop *loop, struct spa_source *source, struct timespec *value,
+			    struct timespec *interval, bool absolute);
+void bench_loop_destroy_source(struct pw_loop *loop, struct spa_source *source);
+
+struct pw_context *bench_context_new(struct pw_loop *main_loop, struct pw_properties *props, size_t user_data_size);
+void bench_context_destroy(struct pw_context *context);
+struct pw_core *bench_context_connect(struct pw_context *context, struct pw_properties *props, size_t user_data_size);
+struct pw_loop *bench_context_get_main_loop(struct pw_context *context);
+
+struct pw_context *bench_core_get_context(struct pw_core *core);
+int bench_core_add_listener(struct pw_core *core, struct spa_hook *listener, const struct pw_core_events *events,
+			    void *data);
+struct pw_registry *bench_core_get_registry(struct pw_core *core, uint32_t version, size_t user_data_size);
+void *bench_core_create_object(struct pw_core *core, const char *factory_name, const char *type, uint32_t version,
+			       const struct spa_dict *props, size_t user_data_size);
+int bench_core_sync(struct pw_core *core, uint32_t id, int seq);
+int bench_core_disconnect(struct pw_core *core);
+
+int bench_registry_add_listener(struct pw_registry *registry, struct spa_hook *listener,
+				const struct pw_registry_events *events, void *data);
+void *bench_registry_bind(struct pw_registry *registry, uint32_t id, const char *type, uint32_t version,
+			  size_t user_data_size);
+int bench_registry_destroy(struct pw_registry *registry, uint32_t id);
+
+void bench_proxy_add_listener(struct pw_proxy *proxy, struct spa_hook *listener, const struct pw_proxy_events *events,
+			      void *data);
+void bench_proxy_add_object_listener(struct pw_proxy *proxy, struct spa_hook *listener, const void *funcs, void *data);
+void *bench_proxy_get_user_data(struct pw_proxy *proxy);
+void bench_proxy_destroy(struct pw_proxy *proxy);
+
+int bench_node_subscribe_params(struct pw_node *node, uint32_t *ids, uint32_t n_ids);
+
+struct pw_stream *bench_stream_new(struct pw_core *core, const char *name, struct pw_properties *props);
+void bench_stream_destroy(struct pw_stream *stream);
+void bench_stream_add_listener(struct pw_stream *stream, struct spa_hook *listener,
+			       const struct pw_stream_events *events, void *data);
+int bench_stream_connect(struct pw_stream *stream, enum pw_direction direction, uint32_t target_id,
+			 enum pw_stream_flags flags, const struct spa_pod **params, uint32_t n_params);
+int bench_stream_disconnect(struct pw_stream *stream);
+enum pw_stream_state bench_stream_get_state(struct pw_stream *stream, const char **error);
+int bench_stream_set_active(struct pw_stream *stream, bool active);
+int bench_stream_update_properties(struct pw_stream *stream, const struct spa_dict *dict);
+
+void bench_register_source_s(const struct obs_source_info *info, size_t size);
+const char *bench_source_get_name(const obs_source_t *source);
+obs_data_t *bench_source_get_settings(const obs_source_t *source);
+bool bench_source_active(const obs_source_t *source);
+void bench_source_update(obs_source_t *source, obs_data_t *settings);
+bool bench_get_audio_info(struct obs_audio_info *oai);
@@ -19,11 +19,20 @@
  */
 
 #include "pipewire-audio.h"
+#include "rt-audit.h"
 
+#include <util/dstr.h>
 #include <util/platform.h>
 
+#include <pipewire/version.h>
+#include <spa/param/latency-utils.h>
 #include <spa/utils/json.h>
 
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
 /* Utilities */
 bool json_object_find(const char *obj, const char *key, char *value, size_t len)
 {
@@ -152,27 +161,890 @@ enum speaker_layout spa_to_obs_speakers(uint32_t channels)
 	}
 }
 
-bool spa_to_obs_pw_audio_info(struct obs_pw_audio_info *info, const struct spa_pod *param)
+bool spa_to_obs_pw_audio_info(struct obs_pw_audio_info *info, const struct spa_pod *param)
+{
+	struct spa_audio_info_raw audio_info;
+
+	if (spa_format_audio_raw_parse(param, &audio_info) < 0) {
+		info->sample_rate = 0;
+		info->format = AUDIO_FORMAT_UNKNOWN;
+		info->speakers = SPEAKERS_UNKNOWN;
+
+		return false;
+	}
+
+	info->sample_rate = audio_info.rate;
+	info->speakers = spa_to_obs_speakers(audio_info.channels);
+	info->format = spa_to_obs_audio_format(audio_info.format);
+
+	return true;
+}
+
+/** The profiler identifies scopes by pointer, keep the names in one place.
+  * The process callback isn't profiled, profile_start allocates and takes the profiler's lock.
+  * Its timing is covered by the deadline miss detection */
+static const char *profile_param_changed = OBS_PW_AUDIO_PROFILE_NAME("stream param changed");
+static const char *profile_metadata_property = OBS_PW_AUDIO_PROFILE_NAME("metadata property");
+
+void obs_pw_audio_profiler_register(void)
+{
+	/* Called on events, not periodically */
+	profile_register_root(profile_param_changed, 0);
+	profile_register_root(profile_metadata_property, 0);
+}
+
+/* Memory locking */
+static void report_lock_failure(struct obs_pw_audio_stream *s, size_t size)
+{
+	if (s->memory.reported_failure) {
+		return;
+	}
+	s->memory.reported_failure = true;
+
+	int error = errno;
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+		blog(LOG_WARNING,
+		     "[pipewire-audio] Stream %p failed to lock %zu bytes of memory: %s. The memlock limit is %llu bytes, raise it to avoid page faults while processing",
+		     s->stream, size, strerror(error), (unsigned long long)limit.rlim_cur);
+	} else {
+		blog(LOG_WARNING, "[pipewire-audio] Stream %p failed to lock %zu bytes of memory: %s", s->stream, size,
+		     strerror(error));
+	}
+}
+
+/** mlock faults the pages in, so this also prefaults them */
+static void lock_region(struct obs_pw_audio_stream *s, void *ptr, size_t size)
+{
+	if (ptr && size && mlock(ptr, size) < 0) {
+		report_lock_failure(s, size);
+	}
+}
+
+static void unlock_region(void *ptr, size_t size)
+{
+	if (ptr && size) {
+		munlock(ptr, size);
+	}
+}
+
+/** Locks work on whole pages and aren't counted, unlocking a page shared with
+  * another allocation unlocks that too. Memory that gets locked is mapped on its own */
+static size_t round_to_pages(size_t size)
+{
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	return SPA_ROUND_UP_N(size, page_size);
+}
+
+/** @param size Whole pages, see round_to_pages */
+static void *alloc_pages(size_t size)
+{
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/** Unmapping drops the locks of the pages too */
+static void free_pages(void *ptr, size_t size)
+{
+	if (ptr && size) {
+		munmap(ptr, size);
+	}
+}
+
+/** The buffers are mapped from the stream's memory pool and usually share the pages of one mapping,
+  * so they're only unlocked all together */
+static void lock_buffer(struct obs_pw_audio_stream *s, struct pw_buffer *b, bool lock)
+{
+	for (uint32_t i = 0; i < b->buffer->n_datas; i++) {
+		struct spa_data *d = &b->buffer->datas[i];
+		if (lock) {
+			lock_region(s, d->data, d->maxsize);
+		} else {
+			unlock_region(d->data, d->maxsize);
+		}
+	}
+}
+
+/** The arena and the packet buffer, they're reallocated on format changes.
+  * The wrapper itself is embedded in its owner's allocation, its pages aren't the stream's to lock */
+static void lock_own_memory(struct obs_pw_audio_stream *s, bool lock)
+{
+	if (lock) {
+		lock_region(s, s->arena.data, s->arena.size);
+		lock_region(s, s->packet.buffer, s->packet.buffer_size);
+	} else {
+		unlock_region(s->arena.data, s->arena.size);
+		unlock_region(s->packet.buffer, s->packet.buffer_size);
+	}
+}
+
+static void lock_memory(struct obs_pw_audio_stream *s, bool lock)
+{
+	if (s->memory.locked == lock) {
+		return;
+	}
+
+	s->memory.locked = lock;
+
+	lock_own_memory(s, lock);
+	for (size_t i = 0; i < s->memory.buffers.num; i++) {
+		lock_buffer(s, s->memory.buffers.array[i], lock);
+	}
+
+	if (lock && !s->memory.reported_failure) {
+		blog(LOG_INFO, "[pipewire-audio] Stream %p locked its memory", s->stream);
+	}
+}
+
+void obs_pw_audio_stream_set_lock_memory(struct obs_pw_audio_stream *s, bool lock)
+{
+	s->memory.enabled = lock;
+	s->memory.reported_failure = false;
+
+	if (!lock) {
+		lock_memory(s, false);
+	} else if (s->stream && pw_stream_get_state(s->stream, NULL) == PW_STREAM_STATE_STREAMING) {
+		lock_memory(s, true);
+	}
+}
+/* ------------------------------------------------- */
+
+/* Scratch arena */
+#define ARENA_ALIGNMENT 64
+#define DEFAULT_QUANTUM_LIMIT 8192
+
+static void arena_reserve(struct obs_pw_audio_arena *arena, size_t size)
+{
+	if (arena->size >= size) {
+		return;
+	}
+
+	free_pages(arena->data, arena->size);
+
+	/* Page aligned, which satisfies ARENA_ALIGNMENT */
+	arena->size = round_to_pages(size);
+	arena->data = alloc_pages(arena->size);
+	if (!arena->data) {
+		arena->size = 0;
+	}
+	arena->used = 0;
+}
+
+/** @return NULL if the arena is exhausted, it's never grown here */
+static void *arena_alloc(struct obs_pw_audio_arena *arena, size_t size)
+{
+	size = SPA_ROUND_UP_N(size, ARENA_ALIGNMENT);
+
+	if (arena->size - arena->used < size) {
+		return NULL;
+	}
+
+	void *ptr = arena->data + arena->used;
+	arena->used += size;
+
+	return ptr;
+}
+
+static void arena_free(struct obs_pw_audio_arena *arena)
+{
+	free_pages(arena->data, arena->size);
+	memset(arena, 0, sizeof(*arena));
+}
+
+static uint32_t get_quantum_limit(struct obs_pw_audio_stream *s)
+{
+	const struct pw_properties *props =
+		pw_context_get_properties(pw_core_get_context(pw_stream_get_core(s->stream)));
+
+	const char *str = props ? pw_properties_get(props, "default.clock.quantum-limit") : NULL;
+	uint32_t limit = str ? strtoul(str, NULL, 10) : 0;
+
+	return limit ? limit : DEFAULT_QUANTUM_LIMIT;
+}
+
+/** Make room for a full copy of the largest possible buffer, which is what fading needs */
+static void arena_resize(struct obs_pw_audio_stream *s)
+{
+	uint32_t channels = get_audio_channels(s->info.speakers);
+	if (!channels || s->info.format == AUDIO_FORMAT_UNKNOWN) {
+		return;
+	}
+
+	size_t planes = is_audio_planar(s->info.format) ? channels : 1;
+	size_t plane_size = (size_t)get_quantum_limit(s) * get_audio_bytes_per_channel(s->info.format) * channels / planes;
+
+	if (s->memory.locked) {
+		unlock_region(s->arena.data, s->arena.size);
+	}
+
+	arena_reserve(&s->arena, planes * SPA_ROUND_UP_N(plane_size, ARENA_ALIGNMENT));
+
+	if (s->memory.locked) {
+		lock_region(s, s->arena.data, s->arena.size);
+	}
+}
+/* ------------------------------------------------- */
+
+/** Buffers the incoming stream drops while waiting for the outgoing one to fade out.
+  * The outgoing stream's node may be gone and never produce another buffer */
+#define HANDOVER_MAX_WAIT 4
+
+static bool handover_ready(struct obs_pw_audio_stream *s)
+{
+	struct obs_pw_audio_stream *from = s->handover.from;
+
+	if (from->handover.silent) {
+		return true;
+	}
+
+	from->handover.fade_out = true;
+
+	if (++s->handover.waited > HANDOVER_MAX_WAIT) {
+		from->handover.fade_out = false;
+		from->handover.silent = true;
+		return true;
+	}
+
+	return false;
+}
+
+/** Apply a linear ramp over the whole packet.
+  * Buffers may be mapped read-only so the samples are copied to the stream's arena */
+static void fade_audio(struct obs_pw_audio_stream *s, struct obs_source_audio *out, bool fade_in)
+{
+	uint32_t channels = get_audio_channels(out->speakers);
+	if (!channels || !out->frames || out->format == AUDIO_FORMAT_UNKNOWN) {
+		return;
+	}
+
+	bool planar = is_audio_planar(out->format);
+	size_t planes = planar ? channels : 1;
+	size_t samples_per_frame = planar ? 1 : channels;
+	size_t sample_size = get_audio_bytes_per_channel(out->format);
+	size_t plane_size = out->frames * samples_per_frame * sample_size;
+
+	if (planes > MAX_AV_PLANES) {
+		return;
+	}
+
+	for (size_t p = 0; p < planes; p++) {
+		if (!out->data[p]) {
+			return;
+		}
+	}
+
+	uint8_t *copies[MAX_AV_PLANES];
+	for (size_t p = 0; p < planes; p++) {
+		if (!(copies[p] = arena_alloc(&s->arena, plane_size))) {
+			/* Larger than the quantum limit, output it as is */
+			return;
+		}
+	}
+
+	for (size_t p = 0; p < planes; p++) {
+		uint8_t *plane = copies[p];
+
+		memcpy(plane, out->data[p], plane_size);
+		out->data[p] = plane;
+
+		for (uint32_t f = 0; f < out->frames; f++) {
+			float gain = (float)f / out->frames;
+			if (!fade_in) {
+				gain = 1.0f - gain;
+			}
+
+			for (size_t c = 0; c < samples_per_frame; c++) {
+				size_t i = f * samples_per_frame + c;
+
+				switch (out->format) {
+				case AUDIO_FORMAT_U8BIT:
+				case AUDIO_FORMAT_U8BIT_PLANAR:
+					plane[i] = (uint8_t)(((float)plane[i] - 128.0f) * gain + 128.0f);
+					break;
+				case AUDIO_FORMAT_16BIT:
+				case AUDIO_FORMAT_16BIT_PLANAR:
+					((int16_t *)plane)[i] = (int16_t)(((int16_t *)plane)[i] * gain);
+					break;
+				case AUDIO_FORMAT_32BIT:
+				case AUDIO_FORMAT_32BIT_PLANAR:
+					((int32_t *)plane)[i] = (int32_t)(((int32_t *)plane)[i] * (double)gain);
+					break;
+				case AUDIO_FORMAT_FLOAT:
+				case AUDIO_FORMAT_FLOAT_PLANAR:
+					((float *)plane)[i] *= gain;
+					break;
+				default:
+					break;
+				}
+			}
+		}
+	}
+}
+
+/* Packetisation */
+static void emit_audio(struct obs_pw_audio_stream *s, struct obs_source_audio *out)
+{
+	obs_source_output_audio(s->output, out);
+
+	s->gap.next_timestamp = out->timestamp + audio_frames_to_ns(out->samples_per_sec, out->frames);
+}
+
+static void packet_flush(struct obs_pw_audio_stream *s)
+{
+	if (!s->packet.frames) {
+		return;
+	}
+
+	struct obs_source_audio out = {
+		.frames = s->packet.frames,
+		.speakers = s->info.speakers,
+		.format = s->info.format,
+		.samples_per_sec = s->info.sample_rate,
+		.timestamp = s->packet.timestamp,
+	};
+
+	size_t plane_size = s->packet.max_frames * s->packet.frame_size;
+	for (size_t i = 0; i < s->packet.planes; i++) {
+		out.data[i] = s->packet.buffer + i * plane_size;
+	}
+
+	emit_audio(s, &out);
+
+	s->packet.frames = 0;
+}
+
+/** Size the packet buffer for the negotiated format.
+  * Done when the format or the budget changes so the process callback never allocates */
+static void packet_resize(struct obs_pw_audio_stream *s)
+{
+	packet_flush(s);
+
+	free_pages(s->packet.buffer, s->packet.buffer_size);
+	s->packet.buffer = NULL;
+	s->packet.buffer_size = 0;
+
+	uint32_t channels = get_audio_channels(s->info.speakers);
+
+	if (!s->packet.latency_ms || !s->info.sample_rate || !channels || s->info.format == AUDIO_FORMAT_UNKNOWN) {
+		s->packet.max_frames = 0;
+		return;
+	}
+
+	bool planar = is_audio_planar(s->info.format);
+
+	s->packet.max_frames = s->info.sample_rate * s->packet.latency_ms / 1000;
+	s->packet.planes = planar ? channels : 1;
+	s->packet.frame_size = get_audio_bytes_per_channel(s->info.format) * (planar ? 1 : channels);
+	s->packet.buffer_size = round_to_pages(s->packet.planes * s->packet.max_frames * s->packet.frame_size);
+	s->packet.buffer = alloc_pages(s->packet.buffer_size);
+
+	if (!s->packet.buffer) {
+		/* Pass quanta on as they come */
+		s->packet.buffer_size = 0;
+		s->packet.max_frames = 0;
+		return;
+	}
+
+	if (s->memory.locked) {
+		lock_region(s, s->packet.buffer, s->packet.buffer_size);
+	}
+}
+
+static void output_audio(struct obs_pw_audio_stream *s, struct obs_source_audio *out)
+{
+	if (!s->packet.max_frames || out->frames >= s->packet.max_frames) {
+		packet_flush(s);
+		emit_audio(s, out);
+		return;
+	}
+
+	for (size_t i = 0; i < s->packet.planes; i++) {
+		if (!out->data[i]) {
+			packet_flush(s);
+			emit_audio(s, out);
+			return;
+		}
+	}
+
+	if (s->packet.frames + out->frames > s->packet.max_frames) {
+		packet_flush(s);
+	} else if (s->packet.frames) {
+		/* Buffers that don't follow each other can't share a packet */
+		uint64_t expected = s->packet.timestamp + audio_frames_to_ns(s->info.sample_rate, s->packet.frames);
+		uint64_t diff = expected > out->timestamp ? expected - out->timestamp : out->timestamp - expected;
+		if (diff > audio_frames_to_ns(s->info.sample_rate, out->frames)) {
+			packet_flush(s);
+		}
+	}
+
+	if (!s->packet.frames) {
+		s->packet.timestamp = out->timestamp;
+	}
+
+	size_t plane_size = s->packet.max_frames * s->packet.frame_size;
+	size_t offset = s->packet.frames * s->packet.frame_size;
+	for (size_t i = 0; i < s->packet.planes; i++) {
+		memcpy(s->packet.buffer + i * plane_size + offset, out->data[i], out->frames * s->packet.frame_size);
+	}
+
+	s->packet.frames += out->frames;
+
+	/* Don't hold on to the packet for another cycle if the next buffer won't fit */
+	if (s->packet.frames + out->frames > s->packet.max_frames) {
+		packet_flush(s);
+	}
+}
+
+void obs_pw_audio_stream_set_packet_latency(struct obs_pw_audio_stream *s, uint32_t latency_ms)
+{
+	if (s->packet.latency_ms == latency_ms) {
+		return;
+	}
+
+	s->packet.latency_ms = latency_ms;
+	packet_resize(s);
+}
+/* ------------------------------------------------- */
+
+/* Gap filling */
+#define GAP_CHECK_INTERVAL_NS (50 * SPA_NSEC_PER_MSEC)
+#define GAP_MIN_THRESHOLD_NS (100 * SPA_NSEC_PER_MSEC)
+
+/** One check interval of silence, shared by every plane since it's all the same.
+  * Allocated along with the format so the timer doesn't allocate */
+static void gap_resize(struct obs_pw_audio_stream *s)
+{
+	bfree(s->gap.silence);
+	s->gap.silence = NULL;
+	s->gap.silence_frames = 0;
+
+	uint32_t channels = get_audio_channels(s->info.speakers);
+	if (!s->info.sample_rate || !channels || s->info.format == AUDIO_FORMAT_UNKNOWN) {
+		return;
+	}
+
+	bool planar = is_audio_planar(s->info.format);
+	size_t frame_size = get_audio_bytes_per_channel(s->info.format) * (planar ? 1 : channels);
+
+	s->gap.silence_frames = (uint32_t)ns_to_audio_frames(s->info.sample_rate, GAP_CHECK_INTERVAL_NS);
+	s->gap.silence = bmalloc(s->gap.silence_frames * frame_size);
+
+	bool is_u8 = s->info.format == AUDIO_FORMAT_U8BIT || s->info.format == AUDIO_FORMAT_U8BIT_PLANAR;
+	memset(s->gap.silence, is_u8 ? 0x80 : 0, s->gap.silence_frames * frame_size);
+}
+
+/** Output silence continuing from the last output up to until */
+static void emit_silence(struct obs_pw_audio_stream *s, uint64_t until)
+{
+	while (s->gap.next_timestamp < until) {
+		uint64_t frames = ns_to_audio_frames(s->info.sample_rate, until - s->gap.next_timestamp);
+		if (!frames) {
+			break;
+		}
+
+		struct obs_source_audio out = {
+			.frames = (uint32_t)SPA_MIN(frames, (uint64_t)s->gap.silence_frames),
+			.speakers = s->info.speakers,
+			.format = s->info.format,
+			.samples_per_sec = s->info.sample_rate,
+			.timestamp = s->gap.next_timestamp,
+		};
+
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			out.data[i] = s->gap.silence;
+		}
+
+		emit_audio(s, &out);
+	}
+}
+
+static void fill_gap(struct obs_pw_audio_stream *s, uint64_t now)
+{
+	if (!s->gap.silence || s->handover.silent || s->handover.from ||
+	    pw_stream_get_state(s->stream, NULL) != PW_STREAM_STATE_STREAMING) {
+		return;
+	}
+
+	/* Armed by the first buffer, the graph may take a while to start calling process */
+	if (s->gap.last_process < s->watchdog.streaming_since) {
+		return;
+	}
+
+	uint64_t threshold = GAP_MIN_THRESHOLD_NS;
+	if (s->pos && s->pos->clock.rate.denom) {
+		/* A few cycles, large quanta are legitimately far apart */
+		uint64_t cycle = s->pos->clock.duration * SPA_NSEC_PER_SEC * s->pos->clock.rate.num /
+				 s->pos->clock.rate.denom;
+		threshold = SPA_MAX(threshold, 3 * cycle);
+	}
+
+	if (now - s->gap.last_process < threshold) {
+		if (s->gap.filling) {
+			s->gap.filling = false;
+			blog(LOG_INFO, "[pipewire-audio] %s is receiving audio again",
+			     obs_source_get_name(s->output));
+		}
+		return;
+	}
+
+	if (!s->gap.filling) {
+		s->gap.filling = true;
+		blog(LOG_INFO, "[pipewire-audio] %s stopped receiving audio, filling with silence",
+		     obs_source_get_name(s->output));
+
+		packet_flush(s);
+
+		if (!s->gap.next_timestamp) {
+			s->gap.next_timestamp = now - threshold;
+		}
+	}
+
+	/* Stay an interval behind so that audio arriving on resume doesn't overlap the silence */
+	uint64_t behind = GAP_CHECK_INTERVAL_NS + (s->latency.compensate ? s->latency.applied_ns : 0);
+	emit_silence(s, now - behind);
+}
+/* ------------------------------------------------- */
+
+/* Clock discontinuities */
+/** Safe to call while processing */
+static bool get_stream_time(struct obs_pw_audio_stream *s, struct pw_time *t)
+{
+#if PW_CHECK_VERSION(0, 3, 50)
+	return pw_stream_get_time_n(s->stream, t, sizeof(*t)) == 0;
+#else
+	return pw_stream_get_time(s->stream, t) == 0;
+#endif
+}
+
+/** Process isn't called from the data thread (no PW_STREAM_FLAG_RT_PROCESS), it may run a cycle or more after
+  * the buffer it dequeues was filled, so s->pos describes the latest cycle and not the buffer's.
+  * The buffer's cycle is worked out from the stream's time instead, the latest cycle minus the buffers
+  * still waiting to be dequeued after this one. Older PipeWire doesn't report those, positions aren't compared then */
+static bool buffer_position(struct obs_pw_audio_stream *s, const struct pw_time *t, uint64_t *position)
+{
+#if PW_CHECK_VERSION(0, 3, 50)
+	if (!t || !t->rate.denom || t->rate.denom != s->pos->clock.rate.denom) {
+		return false;
+	}
+
+	uint64_t behind = (uint64_t)t->avail_buffers * s->pos->clock.duration;
+	if (t->ticks < behind) {
+		return false;
+	}
+
+	*position = t->ticks - behind;
+	return true;
+#else
+	UNUSED_PARAMETER(s);
+	UNUSED_PARAMETER(t);
+	UNUSED_PARAMETER(position);
+	return false;
+#endif
+}
+
+/** Follow the graph clock from buffer to buffer. When a buffer doesn't continue where the previous one ended,
+  * the audio on either side of it isn't contiguous. It's output as a new packet with its own timestamp
+  * and nothing is bridged to the audio before it, OBS resyncs to the new timeline */
+static void check_clock(struct obs_pw_audio_stream *s, const struct pw_time *t)
+{
+	if (!s->pos) {
+		return;
+	}
+
+	const struct spa_io_clock *clock = &s->pos->clock;
+	bool freewheel = (clock->flags & SPA_IO_CLOCK_FLAG_FREEWHEEL) != 0;
+
+	uint64_t position;
+	bool have_position = buffer_position(s, t, &position);
+
+	const char *reason = NULL;
+
+	if (!s->clock.tracking) {
+		/* Nothing to compare the first buffer with */
+	} else if (clock->id != s->clock.id) {
+		reason = "driver change";
+	} else if (clock->rate.denom != s->clock.rate) {
+		reason = "rate change";
+	} else if (freewheel != s->clock.freewheel) {
+		reason = "freewheel";
+	} else if (have_position && s->clock.expected_position) {
+		if (position > s->clock.expected_position) {
+			reason = "skipped cycles";
+		} else if (position < s->clock.expected_position) {
+			reason = "position reset";
+		}
+	}
+
+	s->clock.tracking = true;
+	s->clock.id = clock->id;
+	s->clock.rate = clock->rate.denom;
+	s->clock.freewheel = freewheel;
+	s->clock.expected_position = have_position ? position + clock->duration : 0;
+
+	if (!reason) {
+		return;
+	}
+
+	s->clock.discontinuities++;
+	s->clock.last_reason = reason;
+
+	if (s->handover.silent || s->handover.from) {
+		return;
+	}
+
+	/* Audio from both sides doesn't belong in one packet, and silence filling doesn't continue the old timeline */
+	packet_flush(s);
+	s->gap.next_timestamp = 0;
+}
+
+static void report_discontinuities(struct obs_pw_audio_stream *s)
+{
+	if (s->clock.discontinuities == s->clock.reported_discontinuities) {
+		return;
+	}
+
+	blog(LOG_INFO, "[pipewire-audio] %s had %" PRIu64 " clock discontinuities, the last one from %s",
+	     obs_source_get_name(s->output), s->clock.discontinuities - s->clock.reported_discontinuities,
+	     s->clock.last_reason);
+
+	s->clock.reported_discontinuities = s->clock.discontinuities;
+}
+/* ------------------------------------------------- */
+
+/* Capture latency */
+/* Changes smaller than this are jitter of the driver's delay, following them would jitter the timestamps */
+#define LATENCY_HYSTERESIS_NS (2 * SPA_NSEC_PER_MSEC)
+
+static uint64_t latency_distance(uint64_t a, uint64_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+/** The driver's delay plus the upstream latency of on_latency_param.
+  * Both are taken as is instead of from pw_stream_get_time_n's delay,
+  * which may or may not include the Latency param depending on the PipeWire version */
+static void measure_latency(struct obs_pw_audio_stream *s)
+{
+	if (!s->pos || !s->pos->clock.rate.denom) {
+		return;
+	}
+
+	const struct spa_io_clock *clock = &s->pos->clock;
+
+	uint64_t frames = clock->delay > 0 ? (uint64_t)clock->delay : 0;
+	frames += (uint64_t)(s->latency.upstream_quantum * clock->duration) + s->latency.upstream_rate;
+
+	s->latency.measured_ns = frames * SPA_NSEC_PER_SEC * clock->rate.num / clock->rate.denom +
+				 s->latency.upstream_ns;
+
+	if (latency_distance(s->latency.measured_ns, s->latency.applied_ns) > LATENCY_HYSTERESIS_NS) {
+		s->latency.applied_ns = s->latency.measured_ns;
+	}
+}
+
+static void on_latency_param(struct obs_pw_audio_stream *s, const struct spa_pod *param)
+{
+	struct spa_latency_info info;
+
+	/* Capture latency travels downstream, it arrives at the stream's input port as output latency */
+	if (spa_latency_parse(param, &info) < 0 || info.direction != SPA_DIRECTION_OUTPUT) {
+		return;
+	}
+
+	/* The shortest path upstream, the audio is at least this old when it arrives */
+	s->latency.upstream_quantum = info.min_quantum;
+	s->latency.upstream_rate = info.min_rate;
+	s->latency.upstream_ns = info.min_ns;
+
+	blog(LOG_DEBUG,
+	     "[pipewire-audio] Stream %p upstream latency: quantum %f-%f, rate %u-%u, ns %" PRIu64 "-%" PRIu64,
+	     s->stream, info.min_quantum, info.max_quantum, info.min_rate, info.max_rate, info.min_ns, info.max_ns);
+}
+
+static void report_latency(struct obs_pw_audio_stream *s)
+{
+	if (latency_distance(s->latency.applied_ns, s->latency.reported_ns) <= LATENCY_HYSTERESIS_NS) {
+		return;
+	}
+	s->latency.reported_ns = s->latency.applied_ns;
+
+	blog(LOG_INFO, "[pipewire-audio] %s capture latency is %" PRIu64 " ms%s", obs_source_get_name(s->output),
+	     s->latency.applied_ns / SPA_NSEC_PER_MSEC, s->latency.compensate ? ", compensating" : "");
+}
+
+void obs_pw_audio_stream_set_latency_compensation(struct obs_pw_audio_stream *s, bool compensate)
+{
+	s->latency.compensate = compensate;
+}
+/* ------------------------------------------------- */
+
+/* Watchdog */
+#define WATCHDOG_STALL_NS (2 * SPA_NSEC_PER_SEC)
+#define WATCHDOG_BACKOFF_MIN_NS (500 * SPA_NSEC_PER_MSEC)
+#define WATCHDOG_BACKOFF_MAX_NS (30 * SPA_NSEC_PER_SEC)
+
+static void watchdog_reset(struct obs_pw_audio_stream *s)
+{
+	s->watchdog.stalled_since = 0;
+	s->watchdog.next_attempt = 0;
+	s->watchdog.attempts = 0;
+}
+
+static void watchdog_check(struct obs_pw_audio_stream *s, uint64_t now)
+{
+	if (!s->watchdog.recover || s->handover.from) {
+		return;
+	}
+
+	if (s->watchdog.idle && s->watchdog.idle(s->watchdog.data)) {
+		/* Nothing feeds the stream, not getting buffers is expected */
+		if (s->watchdog.stalled_since) {
+			watchdog_reset(s);
+		}
+		s->watchdog.idle_until = now;
+		return;
+	}
+
+	enum pw_stream_state state = pw_stream_get_state(s->stream, NULL);
+
+	if (s->watchdog.stalled_since) {
+		if (state == PW_STREAM_STATE_STREAMING && s->gap.last_process > s->watchdog.stalled_since) {
+			s->watchdog.recoveries++;
+			s->watchdog.last_recovery_ns = s->gap.last_process - s->watchdog.stalled_since;
+
+			blog(LOG_INFO, "[pipewire-audio] Stream %p recovered after %" PRIu64 " ms and %u attempts",
+			     s->stream, s->watchdog.last_recovery_ns / SPA_NSEC_PER_MSEC, s->watchdog.attempts);
+
+			watchdog_reset(s);
+			return;
+		}
+	} else {
+		uint64_t last = SPA_MAX(SPA_MAX(s->gap.last_process, s->watchdog.streaming_since), s->watchdog.idle_until);
+		if (state != PW_STREAM_STATE_STREAMING || now - last < WATCHDOG_STALL_NS) {
+			return;
+		}
+
+		s->watchdog.stalled_since = last;
+		blog(LOG_WARNING, "[pipewire-audio] Stream %p stalled, no buffers for %" PRIu64 " ms", s->stream,
+		     (now - last) / SPA_NSEC_PER_MSEC);
+	}
+
+	if (now < s->watchdog.next_attempt) {
+		return;
+	}
+
+	uint64_t backoff = SPA_MIN(WATCHDOG_BACKOFF_MIN_NS << SPA_MIN(s->watchdog.attempts, 6u), WATCHDOG_BACKOFF_MAX_NS);
+	s->watchdog.attempts++;
+	s->watchdog.next_attempt = now + backoff;
+
+	blog(LOG_INFO, "[pipewire-audio] Reconnecting stream %p, attempt %u", s->stream, s->watchdog.attempts);
+
+	s->watchdog.recovering = true;
+	s->watchdog.recover(s->watchdog.data);
+	s->watchdog.recovering = false;
+
+	if (pw_stream_get_state(s->stream, NULL) == PW_STREAM_STATE_UNCONNECTED) {
+		blog(LOG_INFO, "[pipewire-audio] Stream %p has nothing to reconnect to", s->stream);
+		watchdog_reset(s);
+	}
+}
+
+void obs_pw_audio_stream_set_watchdog(struct obs_pw_audio_stream *s, void (*recover)(void *data),
+				      bool (*idle)(void *data), void *data)
+{
+	s->watchdog.recover = recover;
+	s->watchdog.idle = idle;
+	s->watchdog.data = data;
+	watchdog_reset(s);
+}
+
+/** The stats are only read by the UI, updating them on the check timer is plenty */
+static void publish_stats(struct obs_pw_audio_stream *s)
+{
+	os_atomic_set_long(&s->stats.latency_ms, (long)(s->latency.applied_ns / SPA_NSEC_PER_MSEC));
+	os_atomic_set_long(&s->stats.recoveries, (long)s->watchdog.recoveries);
+	os_atomic_set_long(&s->stats.last_recovery_ms, (long)(s->watchdog.last_recovery_ns / SPA_NSEC_PER_MSEC));
+	os_atomic_set_long(&s->stats.discontinuities, (long)s->clock.discontinuities);
+}
+
+void obs_pw_audio_stream_add_stats(struct obs_pw_audio_stream *s, obs_properties_t *props)
+{
+	struct dstr stats;
+	dstr_init(&stats);
+	dstr_printf(&stats, "%s: %ld ms, %s: %ld, %s: %ld ms, %s: %ld", obs_module_text("CaptureLatency"),
+		    os_atomic_load_long(&s->stats.latency_ms), obs_module_text("StreamRecoveries"),
+		    os_atomic_load_long(&s->stats.recoveries), obs_module_text("LastRecoveryTime"),
+		    os_atomic_load_long(&s->stats.last_recovery_ms), obs_module_text("ClockDiscontinuities"),
+		    os_atomic_load_long(&s->stats.discontinuities));
+	obs_properties_add_text(props, "StreamStats", stats.array, OBS_TEXT_INFO);
+	dstr_free(&stats);
+}
+/* ------------------------------------------------- */
+
+/** Runs on the same loop as process so nothing here races with it */
+static void on_check_timer_cb(void *data, uint64_t expirations)
+{
+	UNUSED_PARAMETER(expirations);
+
+	struct obs_pw_audio_stream *s = data;
+	uint64_t now = os_gettime_ns();
+
+	fill_gap(s, now);
+	watchdog_check(s, now);
+	report_discontinuities(s);
+	report_latency(s);
+	publish_stats(s);
+}
+
+/* Deadline misses */
+#define DEADLINE_WARNING_INTERVAL_NS (10 * SPA_NSEC_PER_SEC)
+
+/** The cycle's budget is its quantum. Being called late eats into it just like running long does,
+  * comparing both tells if the graph, OBS or the plugin is to blame for an xrun */
+static void check_deadline(struct obs_pw_audio_stream *s, uint64_t start)
 {
-	struct spa_audio_info_raw audio_info;
+	if (!s->pos || !s->pos->clock.nsec || !s->pos->clock.rate.denom) {
+		return;
+	}
 
-	if (spa_format_audio_raw_parse(param, &audio_info) < 0) {
-		info->sample_rate = 0;
-		info->format = AUDIO_FORMAT_UNKNOWN;
-		info->speakers = SPEAKERS_UNKNOWN;
+	uint64_t end = os_gettime_ns();
 
-		return false;
+	uint64_t budget = s->pos->clock.duration * SPA_NSEC_PER_SEC * s->pos->clock.rate.num / s->pos->clock.rate.denom;
+	uint64_t lateness = start > s->pos->clock.nsec ? start - s->pos->clock.nsec : 0;
+	uint64_t run_time = end - start;
+
+	if (!budget || lateness + run_time <= budget) {
+		return;
 	}
 
-	info->sample_rate = audio_info.rate;
-	info->speakers = spa_to_obs_speakers(audio_info.channels);
-	info->format = spa_to_obs_audio_format(audio_info.format);
+	uint64_t overrun = lateness + run_time - budget;
 
-	return true;
+	s->deadline.misses++;
+	if (overrun > s->deadline.worst_overrun) {
+		s->deadline.worst_overrun = overrun;
+	}
+
+	if (end - s->deadline.last_warning < DEADLINE_WARNING_INTERVAL_NS) {
+		return;
+	}
+
+	blog(LOG_WARNING,
+	     "[pipewire-audio] %s missed %" PRIu64 " deadlines. Last one by %" PRIu64 " us (called %" PRIu64
+	     " us late, ran for %" PRIu64 " us of a %" PRIu64 " us cycle), worst overrun %" PRIu64 " us",
+	     obs_source_get_name(s->output), s->deadline.misses - s->deadline.reported_misses, overrun / 1000,
+	     lateness / 1000, run_time / 1000, budget / 1000, s->deadline.worst_overrun / 1000);
+
+	s->deadline.reported_misses = s->deadline.misses;
+	s->deadline.worst_overrun = 0;
+	s->deadline.last_warning = end;
 }
+/* ------------------------------------------------- */
 
 static void on_process_cb(void *data)
 {
+	OBS_PW_AUDIO_RT_AUDIT_ENTER();
+
 	uint64_t now = os_gettime_ns();
 
 	struct obs_pw_audio_stream *s = data;
@@ -180,9 +1052,13 @@ static void on_process_cb(void *data)
 	struct pw_buffer *b = pw_stream_dequeue_buffer(s->stream);
 
 	if (!b) {
+		OBS_PW_AUDIO_RT_AUDIT_LEAVE();
 		return;
 	}
 
+	s->arena.used = 0;
+	s->gap.last_process = now;
+
 	struct spa_buffer *buf = b->buffer;
 
 	if (!s->info.sample_rate || buf->n_datas == 0 || buf->datas[0].chunk->stride == 0 ||
@@ -190,6 +1066,15 @@ static void on_process_cb(void *data)
 		goto queue;
 	}
 
+	struct pw_time time;
+	const struct pw_time *t = get_stream_time(s, &time) ? &time : NULL;
+
+	check_clock(s, t);
+
+	if (s->handover.silent || (s->handover.from && !handover_ready(s))) {
+		goto queue;
+	}
+
 	struct obs_source_audio out = {
 		.frames = buf->datas[0].chunk->size / buf->datas[0].chunk->stride,
 		.speakers = s->info.speakers,
@@ -214,10 +1099,40 @@ static void on_process_cb(void *data)
 		out.timestamp = now - audio_frames_to_ns(s->info.sample_rate, out.frames);
 	}
 
-	obs_source_output_audio(s->output, &out);
+	measure_latency(s);
+	if (s->latency.compensate && out.timestamp > s->latency.applied_ns) {
+		out.timestamp -= s->latency.applied_ns;
+	}
+
+	if (s->handover.from) {
+		fade_audio(s, &out, true);
+		output_audio(s, &out);
+
+		s->handover.from = NULL;
+		s->handover.done_callback(s->handover.data);
+		goto queue;
+	}
+
+	if (s->handover.fade_out) {
+		fade_audio(s, &out, false);
+		output_audio(s, &out);
+
+		/* Nothing else will be output by this stream */
+		packet_flush(s);
+
+		s->handover.fade_out = false;
+		s->handover.silent = true;
+		goto queue;
+	}
+
+	output_audio(s, &out);
 
 queue:
 	pw_stream_queue_buffer(s->stream, b);
+
+	check_deadline(s, now);
+
+	OBS_PW_AUDIO_RT_AUDIT_LEAVE();
 }
 
 static void on_state_changed_cb(void *data, enum pw_stream_state old, enum pw_stream_state state, const char *error)
@@ -228,22 +1143,74 @@ static void on_state_changed_cb(void *data, enum pw_stream_state old, enum pw_st
 
 	blog(LOG_DEBUG, "[pipewire-audio] Stream %p state: \"%s\" (error: %s)", s->stream,
 	     pw_stream_state_as_string(state), error ? error : "none");
+
+	if (state == PW_STREAM_STATE_STREAMING && s->memory.enabled) {
+		lock_memory(s, true);
+	} else if (state == PW_STREAM_STATE_UNCONNECTED || state == PW_STREAM_STATE_ERROR) {
+		lock_memory(s, false);
+	}
+
+	if (state == PW_STREAM_STATE_STREAMING) {
+		s->watchdog.streaming_since = os_gettime_ns();
+	} else if (state == PW_STREAM_STATE_ERROR && s->watchdog.recover && !s->watchdog.stalled_since) {
+		blog(LOG_WARNING, "[pipewire-audio] Stream %p failed: %s", s->stream, error ? error : "unknown error");
+		s->watchdog.stalled_since = os_gettime_ns();
+	} else if (state == PW_STREAM_STATE_UNCONNECTED && !s->watchdog.recovering) {
+		/* Disconnected on purpose */
+		watchdog_reset(s);
+	}
+}
+
+static void on_add_buffer_cb(void *data, struct pw_buffer *buffer)
+{
+	struct obs_pw_audio_stream *s = data;
+
+	da_push_back(s->memory.buffers, &buffer);
+
+	if (s->memory.locked) {
+		lock_buffer(s, buffer, true);
+	}
+}
+
+static void on_remove_buffer_cb(void *data, struct pw_buffer *buffer)
+{
+	struct obs_pw_audio_stream *s = data;
+
+	/* PipeWire unmaps the buffer, or keeps the mapping for the stream's other buffers.
+	 * Either way its pages are unlocked with the rest of the memory, see lock_buffer */
+	da_erase_item(s->memory.buffers, &buffer);
 }
 
 static void on_param_changed_cb(void *data, uint32_t id, const struct spa_pod *param)
 {
+	if (param && id == SPA_PARAM_Latency) {
+		on_latency_param(data, param);
+		return;
+	}
+
 	if (!param || id != SPA_PARAM_Format) {
 		return;
 	}
 
+	profile_start(profile_param_changed);
+
 	struct obs_pw_audio_stream *s = data;
 
+	/* Pending frames are in the old format */
+	packet_flush(s);
+
 	if (!spa_to_obs_pw_audio_info(&s->info, param)) {
 		blog(LOG_WARNING, "[pipewire-audio] Stream %p failed to parse audio format info", s->stream);
 	} else {
 		blog(LOG_INFO, "[pipewire-audio] %p Got format: rate %u - channels %u - format %u", s->stream,
 		     s->info.sample_rate, s->info.speakers, s->info.format);
 	}
+
+	packet_resize(s);
+	arena_resize(s);
+	gap_resize(s);
+
+	profile_end(profile_param_changed);
 }
 
 static void on_io_changed_cb(void *data, uint32_t id, void *area, uint32_t size)
@@ -263,11 +1230,17 @@ static const struct pw_stream_events stream_events = {
 	.state_changed = on_state_changed_cb,
 	.param_changed = on_param_changed_cb,
 	.io_changed = on_io_changed_cb,
+	.add_buffer = on_add_buffer_cb,
+	.remove_buffer = on_remove_buffer_cb,
 };
 
 int obs_pw_audio_stream_connect(struct obs_pw_audio_stream *s, uint32_t target_id, uint32_t target_serial,
 				uint32_t audio_channels)
 {
+	if (!s->stream) {
+		return -EINVAL;
+	}
+
 	if (audio_channels == 0) {
 		blog(LOG_WARNING,
 		     "[pipewire-audio] Stream %p connecting without channel info. Channels may be mapped incorrectly.",
@@ -318,6 +1291,161 @@ int obs_pw_audio_stream_connect(struct obs_pw_audio_stream *s, uint32_t target_i
 		s->stream, PW_DIRECTION_INPUT, target_id,
 		PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_DONT_RECONNECT, params, 1);
 }
+
+void obs_pw_audio_stream_set_active(struct obs_pw_audio_stream *s, bool active)
+{
+	if (s->stream) {
+		pw_stream_set_active(s->stream, active);
+	}
+}
+
+void obs_pw_audio_stream_handover(struct obs_pw_audio_stream *incoming, struct obs_pw_audio_stream *outgoing,
+				  void (*done_callback)(void *data), void *data)
+{
+	incoming->handover.from = outgoing;
+	incoming->handover.waited = 0;
+	incoming->handover.fade_out = false;
+	incoming->handover.silent = false;
+	incoming->handover.done_callback = done_callback;
+	incoming->handover.data = data;
+
+	outgoing->handover.from = NULL;
+	outgoing->handover.fade_out = false;
+	outgoing->handover.silent = false;
+}
+
+void obs_pw_audio_stream_handover_cancel(struct obs_pw_audio_stream *incoming, struct obs_pw_audio_stream *outgoing)
+{
+	incoming->handover.from = NULL;
+
+	outgoing->handover.fade_out = false;
+	outgoing->handover.silent = false;
+}
+
+void obs_pw_audio_stream_swap(struct obs_pw_audio_stream *a, struct obs_pw_audio_stream *b)
+{
+	/* The listeners point to the wrappers, move them along with the streams */
+	spa_hook_remove(&a->stream_listener);
+	spa_hook_remove(&b->stream_listener);
+
+	struct obs_pw_audio_stream tmp = *a;
+	*a = *b;
+	*b = tmp;
+
+	spa_zero(a->stream_listener);
+	spa_zero(b->stream_listener);
+	pw_stream_add_listener(a->stream, &a->stream_listener, &stream_events, a);
+	pw_stream_add_listener(b->stream, &b->stream_listener, &stream_events, b);
+
+	/* The timers were created with their owner's address, keep them there */
+	struct spa_source *timer = a->gap.timer;
+	a->gap.timer = b->gap.timer;
+	b->gap.timer = timer;
+
+	/* The watchdogs and stats belong to whoever embeds the wrappers, only the tracking follows the streams */
+	SPA_SWAP(a->watchdog.recover, b->watchdog.recover);
+	SPA_SWAP(a->watchdog.idle, b->watchdog.idle);
+	SPA_SWAP(a->watchdog.data, b->watchdog.data);
+	SPA_SWAP(a->watchdog.recoveries, b->watchdog.recoveries);
+	SPA_SWAP(a->watchdog.last_recovery_ns, b->watchdog.last_recovery_ns);
+	SPA_SWAP(a->clock.discontinuities, b->clock.discontinuities);
+	SPA_SWAP(a->clock.reported_discontinuities, b->clock.reported_discontinuities);
+	publish_stats(a);
+	publish_stats(b);
+
+	/* Locked memory is all behind pointers and moved with the streams along with the locked flags.
+	 * Whether to lock it is the embedder's setting, apply it to what each wrapper holds now */
+	SPA_SWAP(a->memory.enabled, b->memory.enabled);
+	obs_pw_audio_stream_set_lock_memory(a, a->memory.enabled);
+	obs_pw_audio_stream_set_lock_memory(b, b->memory.enabled);
+}
+
+bool obs_pw_audio_stream_init(struct obs_pw_audio_stream *s, struct pw_core *core, bool capture_sink, bool want_driver,
+			      obs_source_t *output)
+{
+	struct pw_properties *stream_props = pw_properties_new(
+		PW_KEY_MEDIA_NAME, obs_source_get_name(output), PW_KEY_MEDIA_TYPE, "Audio", PW_KEY_MEDIA_CATEGORY,
+		"Capture", PW_KEY_MEDIA_ROLE, "Production", PW_KEY_NODE_WANT_DRIVER, want_driver ? "true" : "false",
+		PW_KEY_STREAM_CAPTURE_SINK, capture_sink ? "true" : "false", NULL);
+
+	pw_properties_setf(stream_props, PW_KEY_NODE_NAME, "OBS: %s", obs_source_get_name(output));
+
+	s->output = output;
+	s->stream = pw_stream_new(core, obs_source_get_name(output), stream_props);
+
+	if (!s->stream) {
+		blog(LOG_WARNING, "[pipewire-audio] Failed to create stream");
+		return false;
+	}
+	blog(LOG_INFO, "[pipewire-audio] Created stream %p", s->stream);
+
+	pw_stream_add_listener(s->stream, &s->stream_listener, &stream_events, s);
+
+	struct timespec interval = {
+		.tv_sec = GAP_CHECK_INTERVAL_NS / SPA_NSEC_PER_SEC,
+		.tv_nsec = GAP_CHECK_INTERVAL_NS % SPA_NSEC_PER_SEC,
+	};
+	s->gap.loop = pw_context_get_main_loop(pw_core_get_context(core));
+	s->gap.timer = pw_loop_add_timer(s->gap.loop, on_check_timer_cb, s);
+	pw_loop_update_timer(s->gap.loop, s->gap.timer, &interval, &interval, false);
+
+	return true;
+}
+
+void obs_pw_audio_stream_destroy(struct obs_pw_audio_stream *s)
+{
+	/* Buffers are gone after disconnecting, without the listener there won't be a remove_buffer for them */
+	lock_memory(s, false);
+	da_free(s->memory.buffers);
+
+	if (s->stream) {
+		spa_hook_remove(&s->stream_listener);
+		if (pw_stream_get_state(s->stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+			pw_stream_disconnect(s->stream);
+		}
+		pw_stream_destroy(s->stream);
+		s->stream = NULL;
+	}
+
+	arena_free(&s->arena);
+
+	if (s->gap.timer) {
+		pw_loop_destroy_source(s->gap.loop, s->gap.timer);
+		s->gap.timer = NULL;
+	}
+	bfree(s->gap.silence);
+	s->gap.silence = NULL;
+
+	free_pages(s->packet.buffer, s->packet.buffer_size);
+	s->packet.buffer = NULL;
+	s->packet.buffer_size = 0;
+	s->packet.max_frames = 0;
+	s->packet.frames = 0;
+
+	/* The wrapper may be initialized again with a new core, drop what belonged to this stream
+	 * and keep the settings and stats */
+	s->pos = NULL;
+	s->info.sample_rate = 0;
+	s->info.format = AUDIO_FORMAT_UNKNOWN;
+	s->info.speakers = SPEAKERS_UNKNOWN;
+
+	s->handover.from = NULL;
+	s->handover.fade_out = false;
+	s->handover.silent = false;
+
+	s->gap.last_process = 0;
+	s->gap.next_timestamp = 0;
+	s->gap.filling = false;
+
+	watchdog_reset(s);
+	s->watchdog.streaming_since = 0;
+	s->watchdog.idle_until = 0;
+
+	s->clock.tracking = false;
+
+	s->latency.measured_ns = 0;
+	s->latency.applied_ns = 0;
+}
 /* ------------------------------------------------- */
 
 /* Common PipeWire components */
@@ -330,12 +1458,23 @@ static void on_core_done_cb(void *data, uint32_t id, int seq)
 	}
 }
 
+static void schedule_reconnect(struct obs_pw_audio_instance *pw);
+
 static void on_core_error_cb(void *data, uint32_t id, int seq, int res, const char *message)
 {
 	struct obs_pw_audio_instance *pw = data;
 
 	blog(LOG_ERROR, "[pipewire-audio] Error id:%u seq:%d res:%d :%s", id, seq, res, message);
 
+	if (id == PW_ID_CORE && res == -EPIPE && !pw->reconnect.disconnected) {
+		blog(LOG_WARNING, "[pipewire-audio] Lost connection to PipeWire, reconnecting");
+
+		pw->reconnect.disconnected = true;
+		pw->reconnect.disconnected_time = os_gettime_ns();
+		pw->reconnect.attempts = 0;
+		schedule_reconnect(pw);
+	}
+
 	pw_thread_loop_signal(pw->thread_loop, false);
 }
 
@@ -345,11 +1484,110 @@ static const struct pw_core_events core_events = {
 	.error = on_core_error_cb,
 };
 
+static bool instance_connect(struct obs_pw_audio_instance *pw, struct pw_core *core)
+{
+	pw->core = core;
+	pw_core_add_listener(pw->core, &pw->core_listener, &core_events, pw);
+
+	pw->registry = pw_core_get_registry(pw->core, PW_VERSION_REGISTRY, 0);
+	if (!pw->registry) {
+		return false;
+	}
+	pw_registry_add_listener(pw->registry, &pw->registry_listener, pw->reconnect.registry_events,
+				 pw->reconnect.data);
+
+	return obs_pw_audio_stream_init(&pw->audio, pw->core, pw->reconnect.stream_capture_sink,
+					pw->reconnect.stream_want_driver, pw->audio.output);
+}
+
+static void instance_disconnect(struct obs_pw_audio_instance *pw)
+{
+	obs_pw_audio_stream_destroy(&pw->audio);
+
+	if (pw->registry) {
+		spa_hook_remove(&pw->registry_listener);
+		spa_zero(pw->registry_listener);
+		pw_proxy_destroy((struct pw_proxy *)pw->registry);
+		pw->registry = NULL;
+	}
+
+	if (pw->core) {
+		spa_hook_remove(&pw->core_listener);
+		spa_zero(pw->core_listener);
+		pw_core_disconnect(pw->core);
+		pw->core = NULL;
+	}
+}
+
+/* Reconnecting */
+#define RECONNECT_DELAY_MIN_NS (100 * SPA_NSEC_PER_MSEC)
+#define RECONNECT_DELAY_MAX_NS (10 * SPA_NSEC_PER_SEC)
+
+static void schedule_reconnect(struct obs_pw_audio_instance *pw)
+{
+	uint64_t delay = SPA_MIN(RECONNECT_DELAY_MIN_NS << SPA_MIN(pw->reconnect.attempts, 7u), RECONNECT_DELAY_MAX_NS);
+
+	struct timespec timeout = {
+		.tv_sec = delay / SPA_NSEC_PER_SEC,
+		.tv_nsec = delay % SPA_NSEC_PER_SEC,
+	};
+	pw_loop_update_timer(pw_thread_loop_get_loop(pw->thread_loop), pw->reconnect.timer, &timeout, NULL, false);
+}
+
+static void on_reconnect_timer_cb(void *data, uint64_t expirations)
+{
+	UNUSED_PARAMETER(expirations);
+
+	struct obs_pw_audio_instance *pw = data;
+
+	if (pw->reconnect.attempts++ == 0) {
+		/* Stop anything from waiting on the dead connection until it's replaced */
+		if (pw_stream_get_state(pw->audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
+			pw_stream_disconnect(pw->audio.stream);
+		}
+	}
+
+	/* The old connection stays in place until there is a new one, so that nothing is NULL while the daemon is away */
+	struct pw_core *core = pw_context_connect(pw->context, NULL, 0);
+	if (!core) {
+		blog(LOG_DEBUG, "[pipewire-audio] Reconnecting to PipeWire failed: %s", strerror(errno));
+		schedule_reconnect(pw);
+		return;
+	}
+
+	/* A previous attempt that failed halfway has already torn the old connection down */
+	if (pw->core) {
+		if (pw->reconnect.lost) {
+			pw->reconnect.lost(pw->reconnect.data);
+		}
+		instance_disconnect(pw);
+	}
+
+	if (!instance_connect(pw, core)) {
+		blog(LOG_WARNING, "[pipewire-audio] Error rebuilding PipeWire connection, retrying");
+
+		/* Sources see no core until a later attempt succeeds */
+		instance_disconnect(pw);
+		schedule_reconnect(pw);
+		return;
+	}
+
+	if (pw->reconnect.restored) {
+		pw->reconnect.restored(pw->reconnect.data);
+	}
+
+	blog(LOG_INFO, "[pipewire-audio] Reconnected to PipeWire after %" PRIu64 " ms and %u attempts",
+	     (os_gettime_ns() - pw->reconnect.disconnected_time) / SPA_NSEC_PER_MSEC, pw->reconnect.attempts);
+
+	pw->reconnect.disconnected = false;
+	pw->reconnect.attempts = 0;
+}
+
 bool obs_pw_audio_instance_init(struct obs_pw_audio_instance *pw, const struct pw_registry_events *registry_events,
 				void *registry_cb_data, bool stream_capture_sink, bool stream_want_driver,
 				obs_source_t *stream_output)
 {
-	pw->thread_loop = pw_thread_loop_new("PipeWire thread loop", NULL);
+	pw->thread_loop = pw_thread_loop_new(OBS_PW_AUDIO_THREAD_LOOP_NAME, NULL);
 	pw->context = pw_context_new(pw_thread_loop_get_loop(pw->thread_loop), NULL, 0);
 
 	pw_thread_loop_lock(pw->thread_loop);
@@ -359,52 +1597,32 @@ bool obs_pw_audio_instance_init(struct obs_pw_audio_instance *pw, const struct p
 		return false;
 	}
 
-	pw->core = pw_context_connect(pw->context, NULL, 0);
-	if (!pw->core) {
-		blog(LOG_WARNING, "[pipewire-audio] Error creating PipeWire core");
-		return false;
-	}
-
-	pw_core_add_listener(pw->core, &pw->core_listener, &core_events, pw);
-
-	pw->registry = pw_core_get_registry(pw->core, PW_VERSION_REGISTRY, 0);
-	if (!pw->registry) {
-		return false;
-	}
-	pw_registry_add_listener(pw->registry, &pw->registry_listener, registry_events, registry_cb_data);
-
-	struct pw_properties *stream_props =
-		pw_properties_new(PW_KEY_MEDIA_NAME, obs_source_get_name(stream_output), PW_KEY_MEDIA_TYPE, "Audio",
-				  PW_KEY_MEDIA_CATEGORY, "Capture", PW_KEY_MEDIA_ROLE, "Production",
-				  PW_KEY_NODE_WANT_DRIVER, stream_want_driver ? "true" : "false",
-				  PW_KEY_STREAM_CAPTURE_SINK, stream_capture_sink ? "true" : "false", NULL);
-
-	pw_properties_setf(stream_props, PW_KEY_NODE_NAME, "OBS: %s", obs_source_get_name(stream_output));
+	pw->reconnect.registry_events = registry_events;
+	pw->reconnect.data = registry_cb_data;
+	pw->reconnect.stream_capture_sink = stream_capture_sink;
+	pw->reconnect.stream_want_driver = stream_want_driver;
+	pw->reconnect.timer = pw_loop_add_timer(pw_thread_loop_get_loop(pw->thread_loop), on_reconnect_timer_cb, pw);
 
 	pw->audio.output = stream_output;
-	pw->audio.stream = pw_stream_new(pw->core, obs_source_get_name(stream_output), stream_props);
 
-	if (!pw->audio.stream) {
-		blog(LOG_WARNING, "[pipewire-audio] Failed to create stream");
+	struct pw_core *core = pw_context_connect(pw->context, NULL, 0);
+	if (!core) {
+		blog(LOG_WARNING, "[pipewire-audio] Error creating PipeWire core");
 		return false;
 	}
-	blog(LOG_INFO, "[pipewire-audio] Created stream %p", pw->audio.stream);
 
-	pw_stream_add_listener(pw->audio.stream, &pw->audio.stream_listener, &stream_events, &pw->audio);
-
-	return true;
+	return instance_connect(pw, core);
 }
 
 void obs_pw_audio_instance_destroy(struct obs_pw_audio_instance *pw)
 {
-	if (pw->audio.stream) {
-		spa_hook_remove(&pw->audio.stream_listener);
-		if (pw_stream_get_state(pw->audio.stream, NULL) != PW_STREAM_STATE_UNCONNECTED) {
-			pw_stream_disconnect(pw->audio.stream);
-		}
-		pw_stream_destroy(pw->audio.stream);
+	if (pw->reconnect.timer) {
+		pw_loop_destroy_source(pw_thread_loop_get_loop(pw->thread_loop), pw->reconnect.timer);
+		pw->reconnect.timer = NULL;
 	}
 
+	obs_pw_audio_stream_destroy(&pw->audio);
+
 	if (pw->registry) {
 		spa_hook_remove(&pw->registry_listener);
 		spa_zero(pw->registry_listener);
@@ -431,9 +1649,35 @@ void obs_pw_audio_instance_sync(struct obs_pw_audio_instance *pw)
 {
 	pw->seq = pw_core_sync(pw->core, PW_ID_CORE, pw->seq);
 }
+
+void obs_pw_audio_instance_set_reconnect_callbacks(struct obs_pw_audio_instance *pw, void (*lost)(void *data),
+						   void (*restored)(void *data))
+{
+	pw->reconnect.lost = lost;
+	pw->reconnect.restored = restored;
+}
 /* ------------------------------------------------- */
 
 /* PipeWire metadata */
+#define DEFAULT_NODE_DEBOUNCE_NS (300 * SPA_NSEC_PER_MSEC)
+
+static void default_node_settled(struct obs_pw_audio_default_node_metadata *metadata)
+{
+	if (strcmp(metadata->pending_name, metadata->name) == 0) {
+		/* Changed back before settling */
+		return;
+	}
+
+	strcpy(metadata->name, metadata->pending_name);
+	metadata->default_node_callback(metadata->data, metadata->name);
+}
+
+static void on_default_node_debounce_cb(void *data, uint64_t expirations)
+{
+	UNUSED_PARAMETER(expirations);
+	default_node_settled(data);
+}
+
 static int on_metadata_property_cb(void *data, uint32_t id, const char *key, const char *type, const char *value)
 {
 	UNUSED_PARAMETER(type);
@@ -442,10 +1686,25 @@ static int on_metadata_property_cb(void *data, uint32_t id, const char *key, con
 
 	if (id == PW_ID_CORE && key && value &&
 	    strcmp(key, metadata->wants_sink ? "default.audio.sink" : "default.audio.source") == 0) {
+		profile_start(profile_metadata_property);
+
 		char val[128];
 		if (json_object_find(value, "name", val, sizeof(val)) && *val) {
-			metadata->default_node_callback(metadata->data, val);
+			strcpy(metadata->pending_name, val);
+
+			if (!*metadata->name) {
+				default_node_settled(metadata);
+			} else {
+				/* Every change restarts the window */
+				struct timespec timeout = {
+					.tv_sec = DEFAULT_NODE_DEBOUNCE_NS / SPA_NSEC_PER_SEC,
+					.tv_nsec = DEFAULT_NODE_DEBOUNCE_NS % SPA_NSEC_PER_SEC,
+				};
+				pw_loop_update_timer(metadata->loop, metadata->debounce_timer, &timeout, NULL, false);
+			}
 		}
+
+		profile_end(profile_metadata_property);
 	}
 
 	return 0;
@@ -471,6 +1730,12 @@ static void on_metadata_proxy_destroy_cb(void *data)
 	spa_zero(metadata->metadata_listener);
 	spa_zero(metadata->proxy_listener);
 
+	pw_loop_destroy_source(metadata->loop, metadata->debounce_timer);
+	metadata->debounce_timer = NULL;
+
+	/* A new metadata object reports its default right away, even if it's the same */
+	metadata->name[0] = '\0';
+
 	metadata->proxy = NULL;
 }
 
@@ -501,6 +1766,9 @@ bool obs_pw_audio_default_node_metadata_listen(struct obs_pw_audio_default_node_
 	metadata->default_node_callback = default_node_callback;
 	metadata->data = data;
 
+	metadata->loop = pw_thread_loop_get_loop(pw->thread_loop);
+	metadata->debounce_timer = pw_loop_add_timer(metadata->loop, on_default_node_debounce_cb, metadata);
+
 	pw_proxy_add_object_listener(metadata->proxy, &metadata->metadata_listener, &metadata_events, metadata);
 	pw_proxy_add_listener(metadata->proxy, &metadata->proxy_listener, &metadata_proxy_events, metadata);
 
@@ -621,3 +1889,114 @@ bool obs_pw_audio_proxy_list_iter_next(struct obs_pw_audio_proxy_list_iter *iter
 	return true;
 }
 /* ------------------------------------------------- */
+
+/* Snapshots of available targets for the UI */
+static struct obs_pw_audio_target_snapshot *target_snapshot_new(uint64_t generation)
+{
+	struct obs_pw_audio_target_snapshot *snapshot = bzalloc(sizeof(struct obs_pw_audio_target_snapshot));
+	snapshot->refs = 1;
+	snapshot->generation = generation;
+	da_init(snapshot->targets);
+	snapshot->connected_serial = SPA_ID_INVALID;
+
+	return snapshot;
+}
+
+static void publish_snapshot(struct obs_pw_audio_target_publisher *publisher,
+			     struct obs_pw_audio_target_snapshot *snapshot)
+{
+	pthread_mutex_lock(&publisher->mutex);
+	struct obs_pw_audio_target_snapshot *old = publisher->current;
+	publisher->current = snapshot;
+	pthread_mutex_unlock(&publisher->mutex);
+
+	if (old) {
+		obs_pw_audio_target_snapshot_release(old);
+	}
+}
+
+static void on_target_snapshot_rebuild_cb(void *data, uint64_t count)
+{
+	UNUSED_PARAMETER(count);
+
+	struct obs_pw_audio_target_publisher *publisher = data;
+
+	/* Only the PipeWire thread publishes, reading current without the mutex is fine here */
+	if (publisher->current && publisher->current->generation == publisher->generation) {
+		return;
+	}
+
+	struct obs_pw_audio_target_snapshot *snapshot = target_snapshot_new(publisher->generation);
+	publisher->rebuild_callback(publisher->data, snapshot);
+
+	publish_snapshot(publisher, snapshot);
+}
+
+void obs_pw_audio_target_publisher_init(struct obs_pw_audio_target_publisher *publisher, struct pw_loop *loop,
+					void (*rebuild_callback)(void *data,
+								 struct obs_pw_audio_target_snapshot *snapshot),
+					void *data)
+{
+	pthread_mutex_init(&publisher->mutex, NULL);
+	publisher->current = target_snapshot_new(0);
+	publisher->generation = 0;
+
+	publisher->loop = loop;
+	publisher->rebuild_event = pw_loop_add_event(loop, on_target_snapshot_rebuild_cb, publisher);
+
+	publisher->rebuild_callback = rebuild_callback;
+	publisher->data = data;
+}
+
+void obs_pw_audio_target_publisher_destroy(struct obs_pw_audio_target_publisher *publisher)
+{
+	pw_loop_destroy_source(publisher->loop, publisher->rebuild_event);
+
+	publish_snapshot(publisher, NULL);
+
+	pthread_mutex_destroy(&publisher->mutex);
+}
+
+void obs_pw_audio_target_publisher_invalidate(struct obs_pw_audio_target_publisher *publisher)
+{
+	publisher->generation++;
+	pw_loop_signal_event(publisher->loop, publisher->rebuild_event);
+}
+
+struct obs_pw_audio_target_snapshot *obs_pw_audio_target_publisher_get(struct obs_pw_audio_target_publisher *publisher)
+{
+	pthread_mutex_lock(&publisher->mutex);
+	struct obs_pw_audio_target_snapshot *snapshot = publisher->current;
+	os_atomic_inc_long(&snapshot->refs);
+	pthread_mutex_unlock(&publisher->mutex);
+
+	return snapshot;
+}
+
+void obs_pw_audio_target_snapshot_add(struct obs_pw_audio_target_snapshot *snapshot, uint32_t serial,
+				      const char *name, const char *app_name, const char *binary)
+{
+	struct obs_pw_audio_target *target = da_push_back_new(snapshot->targets);
+	target->serial = serial;
+	target->name = name ? bstrdup(name) : NULL;
+	target->app_name = app_name ? bstrdup(app_name) : NULL;
+	target->binary = binary ? bstrdup(binary) : NULL;
+}
+
+void obs_pw_audio_target_snapshot_release(struct obs_pw_audio_target_snapshot *snapshot)
+{
+	if (os_atomic_dec_long(&snapshot->refs) != 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < snapshot->targets.num; i++) {
+		struct obs_pw_audio_target *target = &snapshot->targets.array[i];
+		bfree(target->name);
+		bfree(target->app_name);
+		bfree(target->binary);
+	}
+	da_free(snapshot->targets);
+
+	bfree(snapshot);
+}
+/* ------------------------------------------------- */
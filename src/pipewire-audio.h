@@ -28,6 +28,20 @@
 #include <pipewire/extensions/metadata.h>
 #include <spa/param/audio/format-utils.h>
 
+#include <util/darray.h>
+#include <util/profiler.h>
+#include <util/threading.h>
+
+/** Name of the thread that runs all the PipeWire callbacks of an instance.
+  * Profiler scopes are prefixed with it so captures attribute time to the right thread */
+#define OBS_PW_AUDIO_THREAD_LOOP_NAME "PipeWire thread loop"
+#define OBS_PW_AUDIO_PROFILE_NAME(name) OBS_PW_AUDIO_THREAD_LOOP_NAME ": " name
+
+/**
+ * Register the profiler scopes of the streams and metadata as roots of the PipeWire thread loops
+ */
+void obs_pw_audio_profiler_register(void);
+
 /* PipeWire Stream wrapper */
 
 /**
@@ -39,6 +53,17 @@ struct obs_pw_audio_info {
 	enum speaker_layout speakers;
 };
 
+/**
+ * Scratch memory for processing audio in the process callback.
+ * Sized up front from the negotiated format so processing never allocates.
+ * Allocations are aligned to cache lines and released all at once every cycle
+ */
+struct obs_pw_audio_arena {
+	uint8_t *data;
+	size_t size;
+	size_t used;
+};
+
 /**
  * PipeWire stream wrapper that outputs to an OBS source
  */
@@ -49,14 +74,207 @@ struct obs_pw_audio_stream {
 	struct spa_io_position *pos;
 
 	obs_source_t *output;
+
+	/* Gapless switching between two streams, see obs_pw_audio_stream_handover */
+	struct {
+		struct obs_pw_audio_stream *from;
+		uint32_t waited;
+		bool fade_out;
+		bool silent;
+
+		void (*done_callback)(void *data);
+		void *data;
+	} handover;
+
+	struct obs_pw_audio_arena arena;
+
+	/** Small quanta coalesced into larger packets before they're passed to OBS,
+	  * see obs_pw_audio_stream_set_packet_latency */
+	struct {
+		uint32_t latency_ms;
+		uint32_t max_frames;
+		uint32_t frames;
+		uint64_t timestamp;
+
+		size_t planes;
+		size_t frame_size;
+		uint8_t *buffer;
+		size_t buffer_size;
+	} packet;
+
+	/* Memory touched while processing, locked once streaming, see obs_pw_audio_stream_set_lock_memory */
+	struct {
+		bool enabled;
+		bool locked;
+		bool reported_failure;
+		DARRAY(struct pw_buffer *) buffers;
+	} memory;
+
+	/* Silence output while the graph isn't calling process, see obs_pw_audio_stream_init */
+	struct {
+		struct pw_loop *loop;
+		struct spa_source *timer;
+		uint64_t last_process;
+		uint64_t next_timestamp;
+		bool filling;
+
+		uint8_t *silence;
+		uint32_t silence_frames;
+	} gap;
+
+	/* Reconnects the stream when it errors or stops receiving buffers, see obs_pw_audio_stream_set_watchdog */
+	struct {
+		void (*recover)(void *data);
+		bool (*idle)(void *data);
+		void *data;
+		bool recovering;
+
+		uint64_t streaming_since;
+		uint64_t idle_until;
+		uint64_t stalled_since;
+		uint64_t next_attempt;
+		uint32_t attempts;
+
+		uint64_t recoveries;
+		uint64_t last_recovery_ns;
+	} watchdog;
+
+	/* Graph clock as of the last buffer, to notice buffers that don't follow each other */
+	struct {
+		bool tracking;
+		uint32_t id;
+		uint32_t rate;
+		bool freewheel;
+		uint64_t expected_position;
+
+		uint64_t discontinuities;
+		uint64_t reported_discontinuities;
+		const char *last_reason;
+	} clock;
+
+	/* Capture latency measured from the graph, see obs_pw_audio_stream_set_latency_compensation */
+	struct {
+		bool compensate;
+		/* Minimum of the Latency param upstream of the stream, see on_latency_param */
+		float upstream_quantum;
+		uint32_t upstream_rate;
+		uint64_t upstream_ns;
+		uint64_t measured_ns;
+		uint64_t applied_ns;
+		uint64_t reported_ns;
+	} latency;
+
+	/* Process callbacks that finished past the end of their cycle */
+	struct {
+		uint64_t misses;
+		uint64_t reported_misses;
+		uint64_t worst_overrun;
+		uint64_t last_warning;
+	} deadline;
+
+	/* Copies of the stats above for the UI, published atomically from the loop */
+	struct {
+		volatile long latency_ms;
+		volatile long recoveries;
+		volatile long last_recovery_ms;
+		volatile long discontinuities;
+	} stats;
 };
 
+/**
+ * Create a stream that outputs to an OBS source.
+ * If the graph stops calling the stream back while it's streaming, e.g. because its target suspended,
+ * the stream outputs silence so that OBS doesn't keep waiting on the source
+ * @return true on success, false on error
+ */
+bool obs_pw_audio_stream_init(struct obs_pw_audio_stream *s, struct pw_core *core, bool capture_sink, bool want_driver,
+			      obs_source_t *output);
+
+/**
+ * Disconnect and destroy a stream
+ */
+void obs_pw_audio_stream_destroy(struct obs_pw_audio_stream *s);
+
+/**
+ * Coalesce buffers into packets of up to latency_ms before outputting them.
+ * Trades a bounded amount of latency for fewer, cheaper calls into OBS at small quantum sizes
+ * @param latency_ms 0 outputs every buffer as is
+ * @warning Call with the thread loop locked
+ */
+void obs_pw_audio_stream_set_packet_latency(struct obs_pw_audio_stream *s, uint32_t latency_ms);
+
+/**
+ * Lock the stream's buffers, the wrapper and its scratch memory into RAM once the stream is streaming,
+ * so that the first touch of them in the process callback doesn't page fault
+ * @warning Call with the thread loop locked
+ */
+void obs_pw_audio_stream_set_lock_memory(struct obs_pw_audio_stream *s, bool lock);
+
+/**
+ * Shift the stream's timestamps back by the capture latency PipeWire reports,
+ * the driver's delay plus the minimum of the Latency param of the nodes upstream.
+ * The latency is measured either way and shown with the stream stats
+ * @warning Call with the thread loop locked
+ */
+void obs_pw_audio_stream_set_latency_compensation(struct obs_pw_audio_stream *s, bool compensate);
+
+/**
+ * Watch for the stream erroring or not receiving buffers while streaming.
+ * recover is called on the loop to reconnect the stream and called again with backoff until audio flows.
+ * It may leave the stream unconnected to give up, e.g. when the target is gone
+ * @param recover NULL to stop watching
+ * @param idle Optional, returns whether the stream's target currently has nothing to play,
+ *             the stream isn't expected to receive buffers then
+ * @warning Call with the thread loop locked
+ */
+void obs_pw_audio_stream_set_watchdog(struct obs_pw_audio_stream *s, void (*recover)(void *data),
+				      bool (*idle)(void *data), void *data);
+
+/**
+ * Show the stream's latency and how often it was recovered by its watchdog.
+ * Reads the published stats, may be called from any thread without locking the thread loop
+ */
+void obs_pw_audio_stream_add_stats(struct obs_pw_audio_stream *s, obs_properties_t *props);
+
+/**
+ * Fill in the positions of the channels OBS uses for a channel count
+ */
+void obs_channels_to_spa_audio_position(enum spa_audio_channel *position, uint32_t channels);
+
 /**
  * Connect a stream with the default params
  * @return 0 on success, < 0 on error
  */
 int obs_pw_audio_stream_connect(struct obs_pw_audio_stream *s, uint32_t target_id, uint32_t target_serial,
 				uint32_t channels);
+
+/**
+ * Resume or pause a stream. Does nothing if the stream couldn't be (re)created
+ * @warning Call with the thread loop locked
+ */
+void obs_pw_audio_stream_set_active(struct obs_pw_audio_stream *s, bool active);
+
+/**
+ * Hand the output over from one stream to another without a gap.
+ * The incoming stream stays silent until it gets its first buffer. Then the outgoing
+ * stream fades out its next buffer and goes silent, the incoming one fades in and
+ * done_callback is called from its process callback.
+ * @warning Call with the thread loop locked, connecting the incoming stream is up to the caller
+ */
+void obs_pw_audio_stream_handover(struct obs_pw_audio_stream *incoming, struct obs_pw_audio_stream *outgoing,
+				  void (*done_callback)(void *data), void *data);
+
+/**
+ * Abort a handover, the outgoing stream keeps outputting
+ * @warning Call with the thread loop locked
+ */
+void obs_pw_audio_stream_handover_cancel(struct obs_pw_audio_stream *incoming, struct obs_pw_audio_stream *outgoing);
+
+/**
+ * Swap two streams so that a stream embedded somewhere can be replaced by another one
+ * @warning Call with the thread loop locked
+ */
+void obs_pw_audio_stream_swap(struct obs_pw_audio_stream *a, struct obs_pw_audio_stream *b);
 /* ------------------------------------------------- */
 
 /**
@@ -74,6 +292,22 @@ struct obs_pw_audio_instance {
 	struct spa_hook registry_listener;
 
 	struct obs_pw_audio_stream audio;
+
+	/* Rebuilding the connection after the PipeWire daemon went away */
+	struct {
+		const struct pw_registry_events *registry_events;
+		void *data;
+		bool stream_capture_sink;
+		bool stream_want_driver;
+
+		void (*lost)(void *data);
+		void (*restored)(void *data);
+
+		struct spa_source *timer;
+		bool disconnected;
+		uint64_t disconnected_time;
+		uint32_t attempts;
+	} reconnect;
 };
 
 /**
@@ -95,6 +329,19 @@ void obs_pw_audio_instance_destroy(struct obs_pw_audio_instance *pw);
  * Trigger a PipeWire core sync
  */
 void obs_pw_audio_instance_sync(struct obs_pw_audio_instance *pw);
+
+/**
+ * Set what to do when the instance reconnects after the PipeWire daemon restarted.
+ * Both are called on the loop with the registry callback data.
+ * lost is called before the old core is disconnected and should drop everything bound on it
+ * besides the instance's registry and stream. restored is called once the new core, registry and stream exist,
+ * the registry then announces every global again.
+ * If rebuilding fails the instance has no core, registry or stream until a later attempt succeeds,
+ * lost isn't called again for it
+ * @warning Call with the thread loop locked
+ */
+void obs_pw_audio_instance_set_reconnect_callbacks(struct obs_pw_audio_instance *pw, void (*lost)(void *data),
+						   void (*restored)(void *data));
 /* ------------------------------------------------- */
 
 /**
@@ -107,12 +354,20 @@ struct obs_pw_audio_default_node_metadata {
 
 	bool wants_sink;
 
+	/** Defaults may flap during suspend/resume or dock events,
+	  * only a default that stays put for a while is reported */
+	struct pw_loop *loop;
+	struct spa_source *debounce_timer;
+	char pending_name[128];
+	char name[128];
+
 	void (*default_node_callback)(void *data, const char *name);
 	void *data;
 };
 
 /**
  * Add listeners to the metadata
+ * @note The first default is reported immediately, later changes once they settle
  * @return true on success, false on error
  */
 bool obs_pw_audio_default_node_metadata_listen(struct obs_pw_audio_default_node_metadata *metadata,
@@ -169,6 +424,85 @@ void obs_pw_audio_proxy_list_iter_init(struct obs_pw_audio_proxy_list_iter *iter
 bool obs_pw_audio_proxy_list_iter_next(struct obs_pw_audio_proxy_list_iter *iter, void **proxy_user_data);
 /* ------------------------------------------------- */
 
+/* Snapshots of available targets for the UI */
+
+/**
+ * Available target as shown in a source's properties.
+ * Sources fill in the fields that apply to them, the rest are NULL
+ */
+struct obs_pw_audio_target {
+	uint32_t serial;
+	char *name;
+	char *app_name;
+	char *binary;
+};
+
+/**
+ * Immutable list of targets, safe to read from any thread while holding a reference.
+ * Besides the targets, sources fill in the state the UI shows that applies to them
+ */
+struct obs_pw_audio_target_snapshot {
+	volatile long refs;
+	uint64_t generation;
+	DARRAY(struct obs_pw_audio_target) targets;
+
+	/** Target being captured, SPA_ID_INVALID if none */
+	uint32_t connected_serial;
+	bool autoconnect;
+
+	size_t active_links;
+	size_t failed_links;
+};
+
+/**
+ * Publishes snapshots built on the PipeWire thread so that the UI
+ * never has to lock the thread loop to list targets
+ */
+struct obs_pw_audio_target_publisher {
+	pthread_mutex_t mutex;
+	struct obs_pw_audio_target_snapshot *current;
+
+	uint64_t generation;
+	struct pw_loop *loop;
+	struct spa_source *rebuild_event;
+
+	void (*rebuild_callback)(void *data, struct obs_pw_audio_target_snapshot *snapshot);
+	void *data;
+};
+
+/**
+ * @param rebuild_callback Called on the PipeWire thread to fill in a new snapshot
+ * @warning Call with the thread loop locked
+ */
+void obs_pw_audio_target_publisher_init(struct obs_pw_audio_target_publisher *publisher, struct pw_loop *loop,
+					void (*rebuild_callback)(void *data,
+								 struct obs_pw_audio_target_snapshot *snapshot),
+					void *data);
+
+/**
+ * @warning Call with the thread loop locked
+ */
+void obs_pw_audio_target_publisher_destroy(struct obs_pw_audio_target_publisher *publisher);
+
+/**
+ * Mark the published snapshot as outdated. A new one is built once
+ * the loop is idle, so consecutive changes are rebuilt only once
+ * @warning Call from the PipeWire thread
+ */
+void obs_pw_audio_target_publisher_invalidate(struct obs_pw_audio_target_publisher *publisher);
+
+/**
+ * Get the latest snapshot, may be called from any thread
+ * @return A reference to the snapshot, release it with obs_pw_audio_target_snapshot_release
+ */
+struct obs_pw_audio_target_snapshot *obs_pw_audio_target_publisher_get(struct obs_pw_audio_target_publisher *publisher);
+
+void obs_pw_audio_target_snapshot_add(struct obs_pw_audio_target_snapshot *snapshot, uint32_t serial,
+				      const char *name, const char *app_name, const char *binary);
+
+void obs_pw_audio_target_snapshot_release(struct obs_pw_audio_target_snapshot *snapshot);
+/* ------------------------------------------------- */
+
 /* Sources */
 void pipewire_audio_capture_load(void);
 void pipewire_audio_capture_app_load(void);
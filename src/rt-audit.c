@@ -0,0 +1,398 @@
+/* rt-audit.c
+ *
+ * Copyright 2022-2026 Dimitris Papaioannou <dimtpap@protonmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/** Library for auditing the realtime safety of the process callback.
+  * Built with -DENABLE_RT_AUDIT=ON and loaded with LD_PRELOAD, it wraps calls that
+  * may block or allocate. Calls made while a thread is inside the plugin's process
+  * callback are counted and the first few of each kind are printed with a backtrace.
+  * A summary is printed when the process exits.
+  * Built with OBS_PW_AUDIO_ASSERT_NO_ALLOC defined (-DENABLE_ASSERT_NO_ALLOC=ON), it aborts
+  * on the first allocator call made in the callback instead, whoever makes it */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_BACKTRACES 8
+#define MAX_FRAMES 32
+
+enum audited_call {
+	AUDITED_MALLOC,
+	AUDITED_CALLOC,
+	AUDITED_REALLOC,
+	AUDITED_FREE,
+	AUDITED_MUTEX_LOCK,
+	AUDITED_COND_WAIT,
+	AUDITED_COND_TIMEDWAIT,
+	AUDITED_COND_SIGNAL,
+	AUDITED_COND_BROADCAST,
+	AUDITED_FUTEX,
+	AUDITED_READ,
+	AUDITED_WRITE,
+	AUDITED_POLL,
+	AUDITED_PPOLL,
+	AUDITED_NANOSLEEP,
+	AUDITED_MMAP,
+	AUDITED_MUNMAP,
+	AUDITED_COUNT,
+};
+
+static const char *audited_call_names[AUDITED_COUNT] = {
+	"malloc",
+	"calloc",
+	"realloc",
+	"free",
+	"pthread_mutex_lock",
+	"pthread_cond_wait",
+	"pthread_cond_timedwait",
+	"pthread_cond_signal",
+	"pthread_cond_broadcast",
+	"futex",
+	"read",
+	"write",
+	"poll",
+	"ppoll",
+	"nanosleep",
+	"mmap",
+	"munmap",
+};
+
+static atomic_ulong counts[AUDITED_COUNT];
+
+static __thread int process_depth;
+static __thread bool reporting;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_pthread_mutex_lock)(pthread_mutex_t *);
+static int (*real_pthread_cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+static int (*real_pthread_cond_timedwait)(pthread_cond_t *, pthread_mutex_t *, const struct timespec *);
+static int (*real_pthread_cond_signal)(pthread_cond_t *);
+static int (*real_pthread_cond_broadcast)(pthread_cond_t *);
+static long (*real_syscall)(long, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static int (*real_poll)(struct pollfd *, nfds_t, int);
+static int (*real_ppoll)(struct pollfd *, nfds_t, const struct timespec *, const sigset_t *);
+static int (*real_nanosleep)(const struct timespec *, struct timespec *);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+static int (*real_munmap)(void *, size_t);
+
+/* dlsym may allocate before the real allocator is known */
+static _Alignas(16) char bootstrap_heap[4096];
+static size_t bootstrap_used;
+static bool resolving;
+
+static void *bootstrap_alloc(size_t size)
+{
+	size = (size + 15) & ~(size_t)15;
+	if (bootstrap_used + size > sizeof(bootstrap_heap)) {
+		return NULL;
+	}
+
+	void *ptr = bootstrap_heap + bootstrap_used;
+	bootstrap_used += size;
+	return ptr;
+}
+
+static bool is_bootstrap(void *ptr)
+{
+	return (char *)ptr >= bootstrap_heap && (char *)ptr < bootstrap_heap + sizeof(bootstrap_heap);
+}
+
+static void resolve(void)
+{
+	if (real_malloc || resolving) {
+		return;
+	}
+
+	resolving = true;
+
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	real_pthread_mutex_lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+	real_pthread_cond_wait = dlsym(RTLD_NEXT, "pthread_cond_wait");
+	real_pthread_cond_timedwait = dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+	real_pthread_cond_signal = dlsym(RTLD_NEXT, "pthread_cond_signal");
+	real_pthread_cond_broadcast = dlsym(RTLD_NEXT, "pthread_cond_broadcast");
+	real_syscall = dlsym(RTLD_NEXT, "syscall");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_poll = dlsym(RTLD_NEXT, "poll");
+	real_ppoll = dlsym(RTLD_NEXT, "ppoll");
+	real_nanosleep = dlsym(RTLD_NEXT, "nanosleep");
+	real_mmap = dlsym(RTLD_NEXT, "mmap");
+	real_munmap = dlsym(RTLD_NEXT, "munmap");
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+
+	resolving = false;
+}
+
+#ifdef OBS_PW_AUDIO_ASSERT_NO_ALLOC
+static const bool assert_no_alloc = true;
+#else
+static const bool assert_no_alloc = false;
+#endif
+
+static bool is_allocator_call(enum audited_call call)
+{
+	return call == AUDITED_MALLOC || call == AUDITED_CALLOC || call == AUDITED_REALLOC || call == AUDITED_FREE;
+}
+
+static void report(enum audited_call call)
+{
+	if (!process_depth || reporting) {
+		return;
+	}
+
+	/* Reporting itself allocates and writes */
+	reporting = true;
+
+	unsigned long n = atomic_fetch_add(&counts[call], 1) + 1;
+
+	bool trap = assert_no_alloc && is_allocator_call(call);
+
+	if (n <= MAX_BACKTRACES || trap) {
+		char header[160];
+		int len = snprintf(header, sizeof(header),
+				   "[pipewire-audio] RT audit: %s called in the process callback (#%lu)\n",
+				   audited_call_names[call], n);
+		real_write(STDERR_FILENO, header, len);
+
+		void *frames[MAX_FRAMES];
+		int n_frames = backtrace(frames, MAX_FRAMES);
+		backtrace_symbols_fd(frames, n_frames, STDERR_FILENO);
+	}
+
+	if (trap) {
+		abort();
+	}
+
+	reporting = false;
+}
+
+/* Called by the plugin around its process callback */
+void obs_pw_audio_rt_audit_enter(void)
+{
+	process_depth++;
+}
+
+void obs_pw_audio_rt_audit_leave(void)
+{
+	process_depth--;
+}
+
+__attribute__((destructor)) static void print_summary(void)
+{
+	resolve();
+
+	char line[160];
+	int len = snprintf(line, sizeof(line), "[pipewire-audio] RT audit summary of calls in the process callback:\n");
+	real_write(STDERR_FILENO, line, len);
+
+	for (size_t i = 0; i < AUDITED_COUNT; i++) {
+		len = snprintf(line, sizeof(line), "[pipewire-audio]   %s: %lu\n", audited_call_names[i],
+			       atomic_load(&counts[i]));
+		real_write(STDERR_FILENO, line, len);
+	}
+}
+
+/* Wrappers */
+void *malloc(size_t size)
+{
+	resolve();
+	if (!real_malloc) {
+		return bootstrap_alloc(size);
+	}
+
+	report(AUDITED_MALLOC);
+	return real_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	resolve();
+	if (!real_calloc) {
+		/* The bootstrap heap is static, so already zeroed */
+		return bootstrap_alloc(n * size);
+	}
+
+	report(AUDITED_CALLOC);
+	return real_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	resolve();
+
+	if (!real_realloc || !real_malloc || is_bootstrap(ptr)) {
+		if (ptr && !is_bootstrap(ptr)) {
+			/* Can't happen before anything was allocated by the real allocator */
+			return NULL;
+		}
+
+		void *new_ptr = real_malloc ? real_malloc(size) : bootstrap_alloc(size);
+		if (new_ptr && ptr) {
+			size_t available = bootstrap_heap + sizeof(bootstrap_heap) - (char *)ptr;
+			memcpy(new_ptr, ptr, size < available ? size : available);
+		}
+		return new_ptr;
+	}
+
+	report(AUDITED_REALLOC);
+	return real_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	if (!ptr || is_bootstrap(ptr)) {
+		return;
+	}
+
+	resolve();
+	if (!real_free) {
+		/* Only the bootstrap heap exists while resolving */
+		return;
+	}
+
+	report(AUDITED_FREE);
+	real_free(ptr);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	resolve();
+	report(AUDITED_MUTEX_LOCK);
+	return real_pthread_mutex_lock(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+	resolve();
+	report(AUDITED_COND_WAIT);
+	return real_pthread_cond_wait(cond, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime)
+{
+	resolve();
+	report(AUDITED_COND_TIMEDWAIT);
+	return real_pthread_cond_timedwait(cond, mutex, abstime);
+}
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+	resolve();
+	report(AUDITED_COND_SIGNAL);
+	return real_pthread_cond_signal(cond);
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+	resolve();
+	report(AUDITED_COND_BROADCAST);
+	return real_pthread_cond_broadcast(cond);
+}
+
+/** glibc's own locking makes futex calls inline, this catches the ones made through syscall(),
+  * e.g. by PipeWire and SPA. Every syscall takes at most six arguments */
+long syscall(long number, ...)
+{
+	va_list args;
+	va_start(args, number);
+	long a[6];
+	for (size_t i = 0; i < 6; i++) {
+		a[i] = va_arg(args, long);
+	}
+	va_end(args);
+
+	resolve();
+	if (number == SYS_futex) {
+		report(AUDITED_FUTEX);
+	}
+	return real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	resolve();
+	report(AUDITED_READ);
+	return real_read(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	resolve();
+	report(AUDITED_WRITE);
+	return real_write(fd, buf, count);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	resolve();
+	report(AUDITED_POLL);
+	return real_poll(fds, nfds, timeout);
+}
+
+int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout, const sigset_t *sigmask)
+{
+	resolve();
+	report(AUDITED_PPOLL);
+	return real_ppoll(fds, nfds, timeout, sigmask);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	resolve();
+	report(AUDITED_NANOSLEEP);
+	return real_nanosleep(req, rem);
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	resolve();
+	report(AUDITED_MMAP);
+	return real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+int munmap(void *addr, size_t length)
+{
+	resolve();
+	report(AUDITED_MUNMAP);
+	return real_munmap(addr, length);
+}
@@ -0,0 +1,50 @@
+/* rt-audit.h
+ *
+ * Copyright 2022-2026 Dimitris Papaioannou <dimtpap@protonmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Hooks into the realtime safety audit library, see rt-audit.c */
+
+#pragma once
+
+#ifdef OBS_PW_AUDIO_RT_AUDIT
+
+/* Weak so that the plugin still loads when the audit library isn't preloaded */
+void obs_pw_audio_rt_audit_enter(void) __attribute__((weak));
+void obs_pw_audio_rt_audit_leave(void) __attribute__((weak));
+
+#define OBS_PW_AUDIO_RT_AUDIT_ENTER()                 \
+	do {                                          \
+		if (obs_pw_audio_rt_audit_enter) {    \
+			obs_pw_audio_rt_audit_enter(); \
+		}                                     \
+	} while (false)
+
+#define OBS_PW_AUDIO_RT_AUDIT_LEAVE()                 \
+	do {                                          \
+		if (obs_pw_audio_rt_audit_leave) {    \
+			obs_pw_audio_rt_audit_leave(); \
+		}                                     \
+	} while (false)
+
+#else
+
+#define OBS_PW_AUDIO_RT_AUDIT_ENTER() ((void)0)
+#define OBS_PW_AUDIO_RT_AUDIT_LEAVE() ((void)0)
+
+#endif